@@ -0,0 +1,682 @@
+/*
+ * Speed controller benchmark
+ * runs the controller hot path without RT thread, port writes are
+ * captured in memory
+ *
+ * output is CSV, one measurement per line:
+ *     suite,case,metric,value
+ * run with suite names as arguments to select suites, default all
+ * but the slow sqrtcheck
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "global.h"
+#include "sm_driver.h"
+#include "speed_cntr.h"
+#include "output.h"
+#include "latency.h"
+#include "rt_timer.h"
+#include "rt_sched.h"
+
+// Global status flags
+struct GLOBAL_FLAGS status = {FALSE, FALSE, 0};
+
+// 2PI
+#define ONE_TURN	(2*3.1416*100)
+
+// number of times each move is repeated
+#define REPEAT		20
+
+// number of speed_cntr_Move() calls per setup case
+#define MOVE_REPEAT	10000
+
+// number of ticks per port case
+#define PORT_REPEAT	100000
+
+// number of periods and period in ns per timer case
+#define TIMER_REPEAT	2000
+#define TIMER_PERIOD_NS	200000
+
+// number of my_sqrt() calls per sqrt case
+#define SQRT_REPEAT	1000000
+
+static const float turns[] = {1.0, 5.0};
+static const float accels[] = {0.5, 1.0, 4.0};
+static const float speeds[] = {1.0, 4.0};
+
+#define N_ELEM(a)	(sizeof(a)/sizeof((a)[0]))
+
+static long long now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* clock_gettime() cost, subtracted from single call samples */
+static long long clock_overhead(void)
+{
+	long long t0;
+	int n;
+
+	t0 = now_ns();
+	for (n = 0; n < 1000; n++)
+		now_ns();
+	return (now_ns() - t0) / 1001;
+}
+
+static void print_result(const char *suite, const char *name,
+		const char *metric, double value)
+{
+	printf("%s,%s,%s,%.2f\n", suite, name, metric, value);
+}
+
+/* run move set up by speed_cntr_Move() until STOP, and the STOP interrupt */
+static void run_to_stop(void)
+{
+	while (srd.run_state != STOP)
+		speed_cntr_TIMER1_COMPA_interrupt();
+	speed_cntr_TIMER1_COMPA_interrupt();
+	output_capture_len = 0;
+}
+
+/*
+ * ramp: on-line recurrence against precomputed tables
+ */
+struct ramp_result {
+	unsigned int steps;	/* steps of one move */
+	long long total_ns;	/* time of all repeats */
+	long long max_ns;	/* worst case single ACCEL/DECEL step */
+	unsigned int delay[2*RAMP_TABLE_SIZE];
+	unsigned int ndelay;
+};
+
+/*
+ * run one move until STOP, untimed steps add to total_ns,
+ * timed steps update the worst case ACCEL/DECEL step
+ */
+static void run_once(int step, unsigned int accel, unsigned int decel,
+		unsigned int speed, long long overhead, unsigned char timed,
+		struct ramp_result *r)
+{
+	long long t0, t1;
+	unsigned char state;
+
+	speed_cntr_Init_Timer1();
+	speed_cntr_Move(step, accel, decel, speed);
+	t0 = now_ns();
+	while (srd.run_state != STOP){
+		if (timed){
+			state = srd.run_state;
+			t0 = now_ns();
+			speed_cntr_TIMER1_COMPA_interrupt();
+			sm_driver_Flush();
+			t1 = now_ns() - t0 - overhead;
+			if (state != RUN && t1 > r->max_ns)
+				r->max_ns = t1;
+		}
+		else{
+			speed_cntr_TIMER1_COMPA_interrupt();
+			sm_driver_Flush();
+		}
+	}
+	if (!timed)
+		r->total_ns += now_ns() - t0;
+	run_to_stop();
+}
+
+/*
+ * run one move REPEAT times untimed for the mean step cost,
+ * then REPEAT times timing every step for the worst case
+ */
+static void run_move(int step, unsigned int accel, unsigned int decel,
+		unsigned int speed, unsigned char table, struct ramp_result *r)
+{
+	long long overhead = clock_overhead();
+	int n;
+
+	r->steps = 0;
+	r->total_ns = 0;
+	r->max_ns = 0;
+	r->ndelay = 0;
+	srt.enabled = table;
+
+	/* delays of the whole move */
+	speed_cntr_Init_Timer1();
+	speed_cntr_Move(step, accel, decel, speed);
+	while (srd.run_state != STOP){
+		speed_cntr_TIMER1_COMPA_interrupt();
+		r->steps++;
+		if (r->ndelay < 2*RAMP_TABLE_SIZE)
+			r->delay[r->ndelay++] = srd.step_delay;
+	}
+	run_to_stop();
+
+	for (n = 0; n < REPEAT; n++)
+		run_once(step, accel, decel, speed, overhead, FALSE, r);
+	for (n = 0; n < REPEAT; n++)
+		run_once(step, accel, decel, speed, overhead, TRUE, r);
+}
+
+static struct ramp_result online, table;
+
+static void bench_ramp(void)
+{
+	unsigned int i, j, k, n;
+	unsigned int accel, speed;
+	int step;
+	char name[64];
+
+	for (i = 0; i < N_ELEM(turns); i++)
+	for (j = 0; j < N_ELEM(accels); j++)
+	for (k = 0; k < N_ELEM(speeds); k++){
+		step = (int)(turns[i] * SPR);
+		accel = (unsigned int)(accels[j] * ONE_TURN);
+		speed = (unsigned int)(speeds[k] * ONE_TURN);
+
+		run_move(step, accel, accel, speed, FALSE, &online);
+		run_move(step, accel, accel, speed, TRUE, &table);
+
+		/* table path must give the same delays as the recurrence */
+		for (n = 0; n < online.ndelay; n++)
+			if (n >= table.ndelay || online.delay[n] != table.delay[n])
+				break;
+
+		snprintf(name, sizeof(name), "turn=%.1f accel=%.1f speed=%.1f",
+			turns[i], accels[j], speeds[k]);
+		print_result("ramp", name, "steps", online.steps);
+		print_result("ramp", name, "online_ns_step",
+			(double)online.total_ns / (online.steps * REPEAT));
+		print_result("ramp", name, "online_max_ns", online.max_ns);
+		print_result("ramp", name, "table_ns_step",
+			(double)table.total_ns / (table.steps * REPEAT));
+		print_result("ramp", name, "table_max_ns", table.max_ns);
+		print_result("ramp", name, "table_used", srt.valid);
+		print_result("ramp", name, "table_match",
+			n == online.ndelay && n == table.ndelay);
+	}
+}
+
+/*
+ * stop: speed_cntr_Speed(0) halfway through a move, the decel down from
+ * there must be the same with and without tables
+ */
+static unsigned int stop_delay[2][2*RAMP_TABLE_SIZE];
+static unsigned int stop_ndelay[2];
+
+static void bench_stop(void)
+{
+	unsigned int i, j, n;
+	unsigned int accel, speed;
+	int step, mode;
+	char name[64];
+
+	for (i = 0; i < N_ELEM(turns); i++)
+	for (j = 0; j < N_ELEM(accels); j++){
+		step = (int)(turns[i] * SPR);
+		accel = (unsigned int)(accels[j] * ONE_TURN);
+		speed = (unsigned int)(4.0 * ONE_TURN);
+		for (mode = 0; mode <= 1; mode++){
+			srt.enabled = mode;
+			stop_ndelay[mode] = 0;
+			speed_cntr_Init_Timer1();
+			speed_cntr_Move(step, accel, accel, speed);
+			for (n = 0; n < (unsigned int)step / 2; n++)
+				speed_cntr_TIMER1_COMPA_interrupt();
+			speed_cntr_Speed(0);
+			while (srd.run_state != STOP){
+				speed_cntr_TIMER1_COMPA_interrupt();
+				if (stop_ndelay[mode] < 2*RAMP_TABLE_SIZE)
+					stop_delay[mode][stop_ndelay[mode]++] =
+						srd.step_delay;
+			}
+			run_to_stop();
+		}
+		for (n = 0; n < stop_ndelay[0]; n++)
+			if (n >= stop_ndelay[1] || stop_delay[0][n] != stop_delay[1][n])
+				break;
+
+		snprintf(name, sizeof(name), "turn=%.1f accel=%.1f speed=4.0",
+			turns[i], accels[j]);
+		print_result("stop", name, "steps", stop_ndelay[0]);
+		print_result("stop", name, "last_delay",
+			stop_delay[0][stop_ndelay[0] - 1]);
+		print_result("stop", name, "table_match",
+			n == stop_ndelay[0] && n == stop_ndelay[1]);
+	}
+	srt.enabled = FALSE;
+}
+
+/*
+ * state: ns/step in each run state, with port output
+ * the clock is only read when the run state changes
+ * mode 0 and 1 are the linear ramp without and with tables,
+ * mode 2 the S-curve ramp
+ */
+static void bench_state(void)
+{
+	static const char *state_name[] = {"STOP", "ACCEL", "DECEL", "RUN",
+		"SACCEL", "SDECEL"};
+	long long state_ns[6], t0, t1;
+	unsigned long state_steps[6];
+	unsigned char state, last;
+	unsigned int accel, speed, jerk;
+	int n, mode;
+	char name[32];
+
+	/* long move reaching max speed, ramps fit the tables */
+	accel = (unsigned int)(1.0 * ONE_TURN);
+	speed = (unsigned int)(2.0 * ONE_TURN);
+	for (mode = 0; mode <= 2; mode++){
+		memset(state_ns, 0, sizeof(state_ns));
+		memset(state_steps, 0, sizeof(state_steps));
+		srt.enabled = mode == 1;
+		jerk = mode == 2 ? (unsigned int)(10.0 * ONE_TURN) : 0;
+		for (n = 0; n < REPEAT; n++){
+			speed_cntr_Init_Timer1();
+			speed_cntr_Move_SCurve(20 * SPR, accel, accel, speed, jerk);
+			last = srd.run_state;
+			t0 = now_ns();
+			while (srd.run_state != STOP){
+				state = srd.run_state;
+				if (state != last){
+					t1 = now_ns();
+					state_ns[last] += t1 - t0;
+					t0 = t1;
+					last = state;
+				}
+				speed_cntr_TIMER1_COMPA_interrupt();
+				sm_driver_Flush();
+				state_steps[state]++;
+			}
+			state_ns[last] += now_ns() - t0;
+			run_to_stop();
+		}
+		for (state = ACCEL; state <= SDECEL; state++){
+			if (mode == 2 ? state < RUN : state > RUN)
+				continue;
+			if (mode == 2)
+				snprintf(name, sizeof(name), "%s scurve",
+					state_name[state]);
+			else
+				snprintf(name, sizeof(name), "%s table=%d",
+					state_name[state], mode);
+			print_result("state", name, "ns_step", state_steps[state] ?
+				(double)state_ns[state] / state_steps[state] : 0.0);
+		}
+	}
+}
+
+/*
+ * move: speed_cntr_Move() setup cost over a parameter grid, and the cost
+ * left at the junction when the move is planned ahead, speed_cntr_Start()
+ */
+static void bench_move(void)
+{
+	unsigned int i, j, k;
+	unsigned int accel, speed;
+	int step, n, table;
+	long long t0, t1, start_ns, overhead = clock_overhead();
+	char name[64];
+
+	for (table = 0; table <= 1; table++)
+	for (i = 0; i < N_ELEM(turns); i++)
+	for (j = 0; j < N_ELEM(accels); j++)
+	for (k = 0; k < N_ELEM(speeds); k++){
+		step = (int)(turns[i] * SPR);
+		accel = (unsigned int)(accels[j] * ONE_TURN);
+		speed = (unsigned int)(speeds[k] * ONE_TURN);
+		srt.enabled = table;
+
+		t0 = now_ns();
+		for (n = 0; n < MOVE_REPEAT; n++)
+			speed_cntr_Move(step, accel, accel, speed);
+		snprintf(name, sizeof(name),
+			"turn=%.1f accel=%.1f speed=%.1f table=%d",
+			turns[i], accels[j], speeds[k], table);
+		print_result("move", name, "ns_call",
+			(double)(now_ns() - t0) / MOVE_REPEAT);
+
+		start_ns = 0;
+		for (n = 0; n < MOVE_REPEAT; n++){
+			speed_cntr_Plan_Blend(step, accel, accel, speed, 0, 0);
+			t0 = now_ns();
+			speed_cntr_Start();
+			t1 = now_ns();
+			start_ns += t1 - t0 - overhead;
+		}
+		print_result("move", name, "start_ns",
+			(double)start_ns / MOVE_REPEAT);
+	}
+	speed_cntr_Init_Timer1();
+}
+
+/*
+ * port: port writes and ns per tick with all axes stepping every tick,
+ * the step bits are gathered in the shadow register and flushed once,
+ * step pulses (ended in the flush) and dual edge steps
+ */
+static void bench_port(void)
+{
+	unsigned int axes, axis;
+	long long t0;
+	int n;
+	char name[32];
+	unsigned char dual;
+
+	for (dual = 0; dual <= 1; dual++){
+		stepDualEdge = dual;
+		for (axes = 1; axes <= MAX_AXES; axes++){
+			output_capture_len = 0;
+			t0 = now_ns();
+			for (n = 0; n < PORT_REPEAT; n++){
+				for (axis = 0; axis < axes; axis++)
+					sm_driver_AxisStep(axis, CW);
+				sm_driver_Flush();
+			}
+			snprintf(name, sizeof(name), "%s axes=%u",
+				dual ? "dual" : "pulse", axes);
+			print_result("port", name, "ns_tick",
+				(double)(now_ns() - t0) / PORT_REPEAT);
+			print_result("port", name, "writes_tick",
+				(double)output_capture_len / PORT_REPEAT);
+		}
+	}
+	stepDualEdge = FALSE;
+	output_capture_len = 0;
+}
+
+/*
+ * timer: wakeup lateness of the RT timing backends, sleeping to
+ * absolute deadlines one period apart, run as the calling thread,
+ * so use chrt and taskset for RT numbers
+ */
+static const char *timers[] = {
+	"nanosleep", "timerfd", "posix", "hybrid:20", "hybrid:50",
+};
+
+static struct latency_stats timer_stats;
+
+/* TIMER_REPEAT periods with the open backend into timer_stats */
+static void timer_loop(void)
+{
+	struct timespec next, now;
+	long long late;
+	int n;
+
+	latency_init(&timer_stats);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (n = 0; n < TIMER_REPEAT; n++){
+		next.tv_nsec += TIMER_PERIOD_NS;
+		if (next.tv_nsec >= 1000000000){
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		rt_timer_sleep_until(&next);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		late = (now.tv_sec - next.tv_sec) * 1000000000LL +
+			now.tv_nsec - next.tv_nsec;
+		latency_record(&timer_stats, late, TIMER_PERIOD_NS);
+	}
+}
+
+static void print_timer_stats(const char *suite, const char *name)
+{
+	print_result(suite, name, "min_ns", timer_stats.min_ns);
+	print_result(suite, name, "avg_ns",
+		(double)timer_stats.sum_ns / timer_stats.count);
+	print_result(suite, name, "p99_ns",
+		latency_percentile(&timer_stats, 99.0));
+	print_result(suite, name, "max_ns", timer_stats.max_ns);
+}
+
+static void bench_timer(void)
+{
+	unsigned int k;
+
+	for (k = 0; k < N_ELEM(timers); k++){
+		if (!rt_timer_open(timers[k]))
+			continue;
+		timer_loop();
+		rt_timer_close();
+		print_timer_stats("timer", timers[k]);
+	}
+}
+
+/*
+ * policy: the timer loop with nanosleep in a thread under each RT
+ * scheduling policy, needs root, a refused policy is skipped
+ */
+static const struct {
+	const char *name;
+	struct rt_sched sched;
+} policies[] = {
+	{ "fifo", { .policy = RT_SCHED_FIFO, .cpu = -1 } },
+	{ "fifo-cpu0", { .policy = RT_SCHED_FIFO, .cpu = 0 } },
+	{ "deadline", { .policy = RT_SCHED_DEADLINE, .cpu = -1 } },
+};
+
+static void *policy_thread(void *data)
+{
+	const struct rt_sched *s = data;
+
+	if (!rt_sched_enter(s) || !rt_timer_open("nanosleep"))
+		return NULL;
+	timer_loop();
+	rt_timer_close();
+	return (void *)1;
+}
+
+static void bench_policy(void)
+{
+	struct rt_sched s;
+	pthread_attr_t attr;
+	pthread_t thread;
+	void *ok;
+	unsigned int k;
+
+	for (k = 0; k < N_ELEM(policies); k++){
+		s = policies[k].sched;
+		if (s.policy == RT_SCHED_DEADLINE)
+			rt_sched_deadline(&s, TIMER_PERIOD_NS);
+		pthread_attr_init(&attr);
+		ok = NULL;
+		if (!rt_sched_attr(&attr, &s) &&
+				!pthread_create(&thread, &attr, policy_thread, &s))
+			pthread_join(thread, &ok);
+		pthread_attr_destroy(&attr);
+		if (ok)
+			print_timer_stats("policy", policies[k].name);
+	}
+}
+
+/*
+ * controllers: one controller per thread stepping moves at once,
+ * each thread owns a cache line aligned speedCntr, so the step cost
+ * stays flat with the number of threads on a multi core host
+ */
+#define CONTROLLERS_MAX	4
+
+static speedCntr controllers[CONTROLLERS_MAX];
+
+static void *controller_thread(void *data)
+{
+	speedCntr *c = data;
+	unsigned long steps = 0;
+	int k;
+
+	for (k = 0; k < REPEAT; k++){
+		speed_cntr_Init_Timer1_Of(c);
+		speed_cntr_Move_Of(c, 5*SPR, ONE_TURN*1.0, ONE_TURN*1.0,
+				ONE_TURN*4.0);
+		while (c->ramp.run_state != STOP){
+			speed_cntr_Step(c);
+			steps++;
+		}
+		speed_cntr_Step(c);
+	}
+	return (void *)steps;
+}
+
+static void bench_controllers(void)
+{
+	static const unsigned int counts[] = {1, 2, 4};
+	pthread_t thread[CONTROLLERS_MAX];
+	char name[32];
+	void *steps;
+	unsigned long total;
+	long long t0, t1;
+	unsigned int k, n;
+
+	for (k = 0; k < N_ELEM(counts); k++){
+		total = 0;
+		t0 = now_ns();
+		for (n = 0; n < counts[k]; n++){
+			speed_cntr_Init_Of(&controllers[n]);
+			pthread_create(&thread[n], NULL, controller_thread,
+					&controllers[n]);
+		}
+		for (n = 0; n < counts[k]; n++){
+			pthread_join(thread[n], &steps);
+			total += (unsigned long)steps;
+		}
+		t1 = now_ns() - t0;
+		snprintf(name, sizeof(name), "threads=%u", counts[k]);
+		print_result("controllers", name, "steps", total);
+		print_result("controllers", name, "ns_per_step",
+				(double)t1 / total);
+	}
+}
+
+/*
+ * sqrt: throughput of every my_sqrt() variant, my_sqrt() is the
+ * one selected at build time
+ */
+static volatile unsigned long sqrt_sink;
+
+static const struct {
+	const char *name;
+	unsigned long (*sqrt)(unsigned long x);
+} sqrts[] = {
+	{ "my_sqrt", my_sqrt },
+	{ "loop", my_sqrt_loop },
+	{ "newton", my_sqrt_newton },
+	{ "table", my_sqrt_table },
+};
+
+static void bench_sqrt(void)
+{
+	unsigned long x, sum;
+	unsigned int accel, k;
+	long long t0;
+	int n;
+	char name[64];
+
+	for (k = 0; k < N_ELEM(sqrts); k++){
+		/* A_SQ / accel, as called by speed_cntr_Move() */
+		sum = 0;
+		t0 = now_ns();
+		for (n = 0; n < SQRT_REPEAT; n++){
+			accel = 1 + (n & 0xffff);
+			sum += sqrts[k].sqrt(A_SQ / accel);
+		}
+		sqrt_sink = sum;
+		snprintf(name, sizeof(name), "%s A_SQ/accel", sqrts[k].name);
+		print_result("sqrt", name, "ns_call",
+			(double)(now_ns() - t0) / SQRT_REPEAT);
+
+		/* full 32-bit range */
+		sum = 0;
+		x = 1;
+		t0 = now_ns();
+		for (n = 0; n < SQRT_REPEAT; n++){
+			/* xorshift32 */
+			x ^= (x << 13) & 0xffffffff;
+			x ^= x >> 17;
+			x ^= (x << 5) & 0xffffffff;
+			sum += sqrts[k].sqrt(x);
+		}
+		sqrt_sink = sum;
+		snprintf(name, sizeof(name), "%s random32", sqrts[k].name);
+		print_result("sqrt", name, "ns_call",
+			(double)(now_ns() - t0) / SQRT_REPEAT);
+	}
+}
+
+/*
+ * sqrtcheck: every 32-bit input of every variant against the rounding
+ * of my_sqrt_loop(), floor(sqrt(x)) plus one if the remainder is larger
+ * than the root, takes minutes so only run when named
+ */
+static void bench_sqrtcheck(void)
+{
+	unsigned long long x;
+	unsigned long s, expect, bad;
+	unsigned int k;
+
+	for (k = 1; k < N_ELEM(sqrts); k++){
+		bad = 0;
+		/* s = floor(sqrt(x)), kept up to date incrementally */
+		s = 0;
+		for (x = 0; x <= 0xffffffffULL; x++){
+			if ((s + 1) * (s + 1) <= x)
+				s++;
+			expect = s < x - s * s ? s + 1 : s;
+			if (sqrts[k].sqrt(x) != expect)
+				bad++;
+		}
+		print_result("sqrtcheck", sqrts[k].name, "mismatches", bad);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+	int all;	/* run when no suite is named */
+} suites[] = {
+	{ "ramp", bench_ramp, 1 },
+	{ "state", bench_state, 1 },
+	{ "stop", bench_stop, 1 },
+	{ "move", bench_move, 1 },
+	{ "port", bench_port, 1 },
+	{ "timer", bench_timer, 1 },
+	{ "policy", bench_policy, 1 },
+	{ "controllers", bench_controllers, 1 },
+	{ "sqrt", bench_sqrt, 1 },
+	{ "sqrtcheck", bench_sqrtcheck, 0 },
+};
+
+int main(int argc, char* argv[])
+{
+	unsigned int n;
+	int i;
+
+	/* step output captured in memory, no parallel port */
+	if (!output_open("mem"))
+		return 1;
+	sm_driver_Init_IO();
+	/* no step pulse timing, only the port writes are timed */
+	stepPulseWidth = 0;
+	stepDirSetup = 0;
+
+	printf("suite,case,metric,value\n");
+	for (n = 0; n < N_ELEM(suites); n++){
+		if (argc > 1){
+			for (i = 1; i < argc; i++)
+				if (!strcmp(argv[i], suites[n].name))
+					break;
+			if (i == argc)
+				continue;
+		}
+		else if (!suites[n].all)
+			continue;
+		suites[n].run();
+	}
+
+	return 0;
+}
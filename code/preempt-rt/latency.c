@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "latency.h"
+
+/* max width of a histogram bar */
+#define BAR_WIDTH	50
+
+void latency_init(struct latency_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->min_ns = LLONG_MAX;
+}
+
+/* upper bound of the bin holding pct percent of the samples */
+long long latency_percentile(const struct latency_stats *s, double pct)
+{
+	unsigned long limit, sum = 0;
+	int n;
+
+	if (s->count == 0)
+		return 0;
+
+	limit = (unsigned long)(s->count * pct / 100.0);
+	for (n = 0; n < LAT_HIST_BINS; n++){
+		sum += s->hist[n];
+		if (sum >= limit && sum > 0)
+			return (long long)(n + 1) * LAT_BIN_NS;
+	}
+
+	/* in overflow, only max is known */
+	return s->max_ns;
+}
+
+static void print_bar(unsigned long n, unsigned long max)
+{
+	int len = max ? (int)((n * BAR_WIDTH + max - 1) / max) : 0;
+
+	while (len > 0){
+		putchar('*');
+		len--;
+	}
+	putchar('\n');
+}
+
+void latency_dump(const struct latency_stats *s, const char *name)
+{
+	unsigned long max = 0;
+	int n;
+
+	printf("--------------------------------------------------\n");
+	printf(" %s\n", name);
+	printf("--------------------------------------------------\n");
+	if (s->count == 0){
+		printf("   no samples\n");
+		return;
+	}
+	printf("   samples : %lu\n", s->count);
+	printf("       min : %lld ns\n", s->min_ns);
+	printf("       avg : %lld ns\n", s->sum_ns / (long long)s->count);
+	printf("       max : %lld ns\n", s->max_ns);
+	printf("       p50 : < %lld ns\n", latency_percentile(s, 50.0));
+	printf("       p99 : < %lld ns\n", latency_percentile(s, 99.0));
+	printf("     p99.9 : < %lld ns\n", latency_percentile(s, 99.9));
+	printf("    missed : %lu\n", s->misses);
+
+	for (n = 0; n < LAT_HIST_BINS; n++)
+		if (s->hist[n] > max)
+			max = s->hist[n];
+	if (s->overflow > max)
+		max = s->overflow;
+
+	for (n = 0; n < LAT_HIST_BINS; n++){
+		if (s->hist[n] == 0)
+			continue;
+		printf("%5d us %8lu ", n, s->hist[n]);
+		print_bar(s->hist[n], max);
+	}
+	if (s->overflow){
+		printf(">%4d us %8lu ", LAT_HIST_BINS, s->overflow);
+		print_bar(s->overflow, max);
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/* histogram of 1us bins, up to 1ms */
+#define LAT_HIST_BINS	1000
+#define LAT_BIN_NS	1000
+
+/*
+ * latency statistics, written by the RT thread only
+ * and read after pthread_join, so no locking is needed
+ */
+struct latency_stats {
+	long long min_ns;
+	long long max_ns;
+	long long sum_ns;
+	unsigned long count;
+	unsigned long misses;		/* latency over its deadline */
+	unsigned long overflow;		/* latency over the histogram range */
+	unsigned long hist[LAT_HIST_BINS];
+};
+
+void latency_init(struct latency_stats *s);
+long long latency_percentile(const struct latency_stats *s, double pct);
+void latency_dump(const struct latency_stats *s, const char *name);
+
+/* record one sample, no syscall, safe in the RT loop */
+static inline void latency_record(struct latency_stats *s, long long ns,
+		long long deadline_ns)
+{
+	long long bin;
+
+	if (ns < 0)
+		ns = -ns;
+	if (ns < s->min_ns)
+		s->min_ns = ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
+	s->sum_ns += ns;
+	s->count++;
+	if (ns > deadline_ns)
+		s->misses++;
+
+	bin = ns / LAT_BIN_NS;
+	if (bin < LAT_HIST_BINS)
+		s->hist[bin]++;
+	else
+		s->overflow++;
+}
+
+#endif
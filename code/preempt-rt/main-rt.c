@@ -11,13 +11,23 @@
 #include <time.h>
 #include <sys/mman.h>
 #include <inttypes.h>
-#include <sys/io.h>
 #include <signal.h>
+#include <poll.h>
+#include <unistd.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "global.h"
 #include "sm_driver.h"
 #include "speed_cntr.h"
+#include "multi_axis.h"
+#include "motion_queue.h"
 #include "options.h"
+#include "latency.h"
+#include "output.h"
+#include "rt_channel.h"
+#include "step_trace.h"
+#include "rt_timer.h"
+#include "rt_sched.h"
 
 // Global status flags
 struct GLOBAL_FLAGS status = {FALSE, FALSE, 0};
@@ -25,10 +35,28 @@ struct GLOBAL_FLAGS status = {FALSE, FALSE, 0};
 // 2PI
 #define ONE_TURN	(2*3.1416*100)
 
-int running = true;
-int rt_thread_started = false;
-int total_step_count = 0;
-int total_steps;
+/* cleared by ctrl-c or by main() when the move is done, ends the RT loop */
+atomic_int running = true;
+
+/* RT thread only, the rest is told to main() by events */
+static int rt_moving;		/* a move or the motion queue is running */
+static int rt_step_count;	/* master axis steps of the move */
+
+/* RT thread scheduling, set by main() before the thread starts */
+static struct rt_sched rt_sched_cfg;
+
+/* RT clock at loop start and at the last DONE, read after pthread_join */
+static long long rt_start_ns;
+static long long rt_done_ns;
+
+/* deadline overruns, read after pthread_join */
+static unsigned long overruns;		/* wakeups past the next deadline */
+static unsigned long overrun_periods;	/* periods or steps missed by them */
+static int rt_aborting;			/* move aborted on overrun, stopping */
+
+/* RT loop instrumentation, dumped after pthread_join */
+static struct latency_stats wakeup_stats;
+static struct latency_stats step_stats;
 
 void signalHandler(int sig)
 {
@@ -38,57 +66,141 @@ void signalHandler(int sig)
 struct period_info {
         struct timespec next_period;
         long period_ns;
+	int overrun;		/* OVERRUN_* policy */
+	int behind;		/* catching up missed periods */
 };
  
+/* stop time must be larger than start time */
+void timespec_diff(struct timespec *start, struct timespec *stop,
+                   struct timespec *result)
+{
+    if ((stop->tv_nsec - start->tv_nsec) < 0) {
+        result->tv_sec = stop->tv_sec - start->tv_sec - 1;
+        result->tv_nsec = stop->tv_nsec - start->tv_nsec + 1000000000;
+    } else {
+        result->tv_sec = stop->tv_sec - start->tv_sec;
+        result->tv_nsec = stop->tv_nsec - start->tv_nsec;
+    }
+
+    return;
+}
+
+static void inc_period_ns(struct period_info *pinfo, long long ns)
+{
+	pinfo->next_period.tv_sec += ns / 1000000000;
+	pinfo->next_period.tv_nsec += ns % 1000000000;
+
+	while (pinfo->next_period.tv_nsec >= 1000000000) {
+		/* timespec nsec overflow */
+		pinfo->next_period.tv_sec++;
+		pinfo->next_period.tv_nsec -= 1000000000;
+	}
+}
+
 static void inc_period(struct period_info *pinfo) 
 {
-        pinfo->next_period.tv_nsec += pinfo->period_ns;
- 
-        while (pinfo->next_period.tv_nsec >= 1000000000) {
-                /* timespec nsec overflow */
-                pinfo->next_period.tv_sec++;
-                pinfo->next_period.tv_nsec -= 1000000000;
-        }
+	inc_period_ns(pinfo, pinfo->period_ns);
 }
  
-static void periodic_task_init(struct period_info *pinfo)
+static long long timespec_ns(struct timespec *t)
 {
-        /* for simplicity, hardcoding a 1ms period */
-        /* pinfo->period_ns = 1000000; */
-
-	/* hardcoding a 2.17us = 2170 ns = 460.75khz */
-        //pinfo->period_ns = 2170;
-        
-	/* 217000ns = 4.6khz */
-        pinfo->period_ns = 217000;
+	return (long long)t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+static void periodic_task_init(struct period_info *pinfo, int overrun)
+{
+	/*
+	 * about 217000ns = 4.6khz, a whole number of timer/counter ticks,
+	 * derived from the timer frequency by speed_cntr_Config()
+	 */
+        pinfo->period_ns = scp.period_ns;
+	pinfo->overrun = overrun;
+	pinfo->behind = false;
  
-        clock_gettime(CLOCK_MONOTONIC, &(pinfo->next_period));
+        rt_timer_now(&(pinfo->next_period));
+	rt_start_ns = timespec_ns(&pinfo->next_period);
 }
  
+static void rt_event_post(int type, int value, int cmd)
+{
+	struct rt_event e = { type, value, rt_step_count, cmd };
+
+	/* a full queue drops the event, the RT loop never waits */
+	rt_event_send(&e);
+}
+
+/* decelerate to stop on overrun, hard stop when that is not possible */
+static void overrun_abort(void)
+{
+	if (!rt_moving || rt_aborting)
+		return;
+	rt_aborting = true;
+	motion_queue_Init(mq.blend);
+	if (!speed_cntr_Speed(0))
+		speed_cntr_Stop();
+	rt_event_post(RT_EVENT_ERROR, RT_ERR_OVERRUN, 0);
+}
+
+/*
+ * a wakeup later than the interval slept is past the next deadline too,
+ * catch up runs the missed intervals back to back, the deadlines being
+ * absolute, skip and abort re-anchor the deadlines to now
+ */
+static void overrun_check(struct period_info *pinfo, struct timespec *now,
+		long long late_ns, long long interval_ns)
+{
+	if (late_ns < interval_ns){
+		pinfo->behind = false;
+		return;
+	}
+	/* count the first wakeup of a catch up only */
+	if (!pinfo->behind){
+		overruns++;
+		overrun_periods += late_ns / interval_ns;
+	}
+	switch (pinfo->overrun){
+		case OVERRUN_ABORT:
+			overrun_abort();
+			/* fall through */
+		case OVERRUN_SKIP:
+			pinfo->next_period = *now;
+			break;
+		case OVERRUN_CATCHUP:
+		default:
+			pinfo->behind = true;
+			break;
+	}
+}
+
+/* sleep until next_period, interval_ns after the last, and record how late the wakeup was */
+static void sleep_next_period(struct period_info *pinfo, long long interval_ns)
+{
+	struct timespec now, late;
+
+	rt_timer_sleep_until(&pinfo->next_period);
+
+	rt_timer_now(&now);
+	timespec_diff(&pinfo->next_period, &now, &late);
+	latency_record(&wakeup_stats, timespec_ns(&late), pinfo->period_ns);
+	overrun_check(pinfo, &now, timespec_ns(&late), interval_ns);
+}
+
 static void wait_rest_of_period(struct period_info *pinfo)
 {
         inc_period(pinfo);
- 
-        /* for simplicity, ignoring possibilities of signal wakes */
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pinfo->next_period, NULL);
+	sleep_next_period(pinfo, pinfo->period_ns);
 }
 
-
-/* stop time must be larger than start time */
-void timespec_diff(struct timespec *start, struct timespec *stop,
-                   struct timespec *result)
+/* sleep until an absolute deadline 'delay' timer/counter ticks after the last one */
+static void wait_timer_ticks(struct period_info *pinfo, unsigned int delay)
 {
-    if ((stop->tv_nsec - start->tv_nsec) < 0) {
-        result->tv_sec = stop->tv_sec - start->tv_sec - 1;
-        result->tv_nsec = stop->tv_nsec - start->tv_nsec + 1000000000;
-    } else {
-        result->tv_sec = stop->tv_sec - start->tv_sec;
-        result->tv_nsec = stop->tv_nsec - start->tv_nsec;
-    }
+	long long interval_ns = (long long)delay * 1000000000 / scp.t1_freq;
 
-    return;
+	inc_period_ns(pinfo, interval_ns);
+	sleep_next_period(pinfo, interval_ns);
 }
 
+
 void print_x(int n)
 {
 	while (n>0){
@@ -99,107 +211,589 @@ void print_x(int n)
 
 }
 
-void *simple_cyclic_task(void *data)
+/* handle the pending commands from main() */
+static void rt_command_poll(void)
 {
-        struct period_info pinfo;
-	int count = 0;
+	struct rt_cmd c;
+
+	while (rt_cmd_recv(&c)){
+		switch (c.type){
+			case RT_CMD_MOVE:
+			case RT_CMD_QUEUE:
+				if (rt_moving){
+					rt_event_post(RT_EVENT_ERROR, RT_ERR_BUSY, c.type);
+					break;
+				}
+				rt_moving = true;
+				rt_aborting = false;
+				rt_step_count = 0;
+				if (c.type == RT_CMD_MOVE)
+					multi_axis_Move(c.axes, c.step, c.accel,
+						c.decel, c.speed, c.jerk);
+				else
+					motion_queue_Next();
+				break;
+			case RT_CMD_STOP:
+				motion_queue_Init(mq.blend);
+				speed_cntr_Stop();
+				break;
+			case RT_CMD_VELOCITY:
+				if (rt_moving){
+					rt_event_post(RT_EVENT_ERROR, RT_ERR_BUSY, c.type);
+					break;
+				}
+				rt_moving = true;
+				rt_aborting = false;
+				rt_step_count = 0;
+				/* single axis */
+				stepAxis = 0;
+				speed_cntr_Velocity(c.step[0] < 0 ? CCW : CW,
+					c.accel, c.decel, c.speed);
+				break;
+			case RT_CMD_SPEED:
+				if (!speed_cntr_Speed(c.speed))
+					rt_event_post(RT_EVENT_ERROR, RT_ERR_SPEED, c.type);
+				break;
+			default:
+				rt_event_post(RT_EVENT_ERROR, RT_ERR_CMD, c.type);
+				break;
+		}
+	}
+}
+
+/* the move is done after the STOP interrupt, with an empty queue */
+static void rt_done_check(void)
+{
+	static int done_time;
+	struct timespec now;
+
+	if (rt_moving && srd.run_state == STOP && !status.running){
+		if (!done_time){
+			rt_timer_now(&now);
+			rt_done_ns = timespec_ns(&now);
+			done_time = true;
+		}
+		/* DONE is never dropped, wait for main() to drain the steps */
+		if (rt_ring_full(&rt_eventq.ring))
+			return;
+		rt_moving = false;
+		done_time = false;
+		rt_event_post(RT_EVENT_DONE, 0, 0);
+	}
+}
+
+/*
+ * step progress to main(), coalesced to one event per RT_PROGRESS_NS,
+ * none while the queue is full, the next one carries the step count on
+ */
+static void rt_progress_post(int dir, struct timespec *now)
+{
+	static long long last_ns = -RT_PROGRESS_NS;
+
+	if (timespec_ns(now) - last_ns < RT_PROGRESS_NS ||
+	    rt_ring_full(&rt_eventq.ring))
+		return;
+	last_ns = timespec_ns(now);
+	rt_event_post(RT_EVENT_PROGRESS, dir, 0);
+}
+
+/* do realtime task, ie one timer/counter compare output */
+static void timer_compare_output(struct period_info *pinfo)
+{
+	/* last step edge and the step_delay planned after it */
+	static struct timespec last_step;
+	static long long planned_ns = -1;
+	struct timespec now, interval;
 	int rc;
-	int current_time = 0;
-	
-	printf("%s started\n", __FUNCTION__);	 
-        periodic_task_init(&pinfo);
+
+	rc = multi_axis_TIMER1_COMPA_interrupt();
+	switch(rc){
+		case NOACT:
+			break;
+		case CW:
+		case CCW:
+			rt_step_count++;
+			rt_timer_now(&now);
+			rt_progress_post(rc, &now);
+			/* step edge error against planned step_delay */
+			if (planned_ns >= 0){
+				timespec_diff(&last_step, &now, &interval);
+				latency_record(&step_stats,
+					timespec_ns(&interval) - planned_ns,
+					pinfo->period_ns);
+			}
+			last_step = now;
+			planned_ns = (long long)OCR1A * 1000000000 / scp.t1_freq;
+			step_trace_record(timespec_ns(&now), OCR1A, rc,
+				srd.run_state, sm_driver_Port(), stepAxis);
+			break;
+	}
+	/* move done, start next queued move before the STOP interrupt */
+	if (srd.run_state == STOP)
+		motion_queue_Next();
+	/* else plan it now, off the junction */
+	else if (rc != NOACT)
+		motion_queue_Prepare();
+	rt_done_check();
+}
+
+/*
+ * tick scheduling: wake every period and count timer/counter ticks,
+ * every step is rounded to a whole period
+ */
+static void tick_cyclic_loop(struct period_info *pinfo)
+{
+	unsigned int count = 0;
+	/* timer/counter ticks per period */
+	unsigned int ticks = scp.period_ticks;
+
         while (running){
-		rt_thread_started = true;
+		rt_command_poll();
 		/* Time/counter enabled */
 		if ((TCCR1B & (1<<CS11)) && (OCR1A > 0)){
-			count++;
+			count += ticks;
 			/* timer/counter compare output */
 	                if (count >= OCR1A){
 				/* reset count */
 				count = 0;
-				/* do realtime task */
-				rc = speed_cntr_TIMER1_COMPA_interrupt();
-				switch(rc){
-					case NOACT:
+				timer_compare_output(pinfo);
+				/* one port write for all axes */
+				sm_driver_Flush();
+			}
+		}
+		else{
+			/* timer/counter disabled */
+			count = 0 ;
+			rt_done_check();
+		}
+                wait_rest_of_period(pinfo);
+        }
+}
+
+/*
+ * dda scheduling: wake every period like tick, but the ticks past the
+ * step edge are carried to the next step instead of dropped, so the mean
+ * step rate follows step_delay, not step_delay rounded up to whole periods,
+ * a step is at most one period late
+ * steps due faster than the loop rate go out in a burst of up to 'burst'
+ * steps, each step_delay after the previous one, spinning in the first
+ * LOOP_BURST_SPIN_PCT of the period, every step runs the ramp interrupt
+ */
+static void dda_cyclic_loop(struct period_info *pinfo, int burst)
+{
+	/* timer/counter ticks since the last step edge */
+	unsigned int phase = 0;
+	/* timer/counter ticks per period */
+	unsigned int ticks = scp.period_ticks;
+	struct timespec edge;
+	long long edge_ns, spin_end_ns;
+	int n;
+
+        while (running){
+		rt_command_poll();
+		/* Time/counter enabled */
+		if ((TCCR1B & (1<<CS11)) && (OCR1A > 0)){
+			phase += ticks;
+			/* timer/counter compare output */
+			if (phase >= OCR1A){
+				rt_timer_now(&edge);
+				edge_ns = timespec_ns(&edge);
+				spin_end_ns = timespec_ns(&pinfo->next_period) +
+					(long long)pinfo->period_ns * LOOP_BURST_SPIN_PCT / 100;
+				for (n = 1; ; n++){
+					phase -= OCR1A;
+					timer_compare_output(pinfo);
+					/* one port write for all axes */
+					sm_driver_Flush();
+					/* next step of the burst, step_delay after this one */
+					if (n >= burst || phase < OCR1A ||
+					    !(TCCR1B & (1<<CS11)) || OCR1A == 0)
 						break;
-					case CW:
-					case CCW:
-						current_time++;
-						total_step_count++;
+					edge_ns += (long long)OCR1A * 1000000000 / scp.t1_freq;
+					if (edge_ns > spin_end_ns)
 						break;
+					edge.tv_sec = edge_ns / 1000000000;
+					edge.tv_nsec = edge_ns % 1000000000;
+					rt_timer_spin_until(&edge);
 				}
+				/* ticks this step is late on its edge */
+				if (phase >= ticks)
+					phase = ticks - 1;
 			}
 		}
 		else{
 			/* timer/counter disabled */
-			count = 0 ;
+			phase = 0;
+			rt_done_check();
 		}
-                wait_rest_of_period(&pinfo);
-		if (total_step_count >= total_steps)
-			break;
+                wait_rest_of_period(pinfo);
         }
+}
+
+/*
+ * event scheduling: sleep straight to the next step edge,
+ * OCR1A timer/counter ticks after the previous one
+ */
+static void event_cyclic_loop(struct period_info *pinfo)
+{
+	while (running){
+		rt_command_poll();
+		/* Time/counter enabled */
+		if ((TCCR1B & (1<<CS11)) && (OCR1A > 0)){
+			wait_timer_ticks(pinfo, OCR1A);
+			timer_compare_output(pinfo);
+			/* one port write for all axes */
+			sm_driver_Flush();
+		}
+		else{
+			/* timer/counter disabled, poll at period rate */
+			rt_done_check();
+			wait_rest_of_period(pinfo);
+		}
+	}
+}
+
+void *simple_cyclic_task(void *data)
+{
+	struct motor_options *p = data;
+        struct period_info pinfo;
+	
+	printf("%s started\n", __FUNCTION__);	 
+	/* SCHED_DEADLINE is set by the thread itself */
+	if (!rt_sched_enter(&rt_sched_cfg)){
+		rt_event_post(RT_EVENT_ERROR, RT_ERR_SCHED, 0);
+		running = false;
+		return NULL;
+	}
+	/* timer backend sleeps in this thread */
+	if (!rt_timer_open(p->timer)){
+		rt_event_post(RT_EVENT_ERROR, RT_ERR_TIMER, 0);
+		running = false;
+		return NULL;
+	}
+        periodic_task_init(&pinfo, p->overrun);
+	switch (p->sched){
+		case LOOP_EVENT:
+			event_cyclic_loop(&pinfo);
+			break;
+		case LOOP_DDA:
+			dda_cyclic_loop(&pinfo, p->burst);
+			break;
+		case LOOP_TICK:
+		default:
+			tick_cyclic_loop(&pinfo);
+			break;
+	}
+	rt_timer_close();
  
         return NULL;
 }
  
+/*
+ * jog: read new speeds in turn/sec from stdin, one per line, and send
+ * them to the RT thread, waits at most 1ms, end of input stops the motor
+ */
+static void jog_input(int *eof)
+{
+	static char line[64];
+	static int len;
+	struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+	struct rt_cmd cmd = { .type = RT_CMD_SPEED };
+	char c;
+
+	if (poll(&pfd, 1, 1) <= 0)
+		return;
+	while (read(STDIN_FILENO, &c, 1) == 1){
+		if (c != '\n'){
+			if (len < (int)sizeof(line) - 1)
+				line[len++] = c;
+			continue;
+		}
+		line[len] = 0;
+		len = 0;
+		cmd.speed = (unsigned int)(atof(line) * ONE_TURN);
+		printf("jog speed %s turn/sec\n", line);
+		rt_cmd_send(&cmd);
+		return;
+	}
+	/* end of input */
+	cmd.speed = 0;
+	rt_cmd_send(&cmd);
+	*eof = true;
+}
+
+/*
+ * SCHED_DEADLINE period: the loop period, or with event scheduling
+ * the shortest step period at the move speed when it is shorter
+ */
+static unsigned long long deadline_period_ns(struct motor_options *p,
+		unsigned int speed)
+{
+	unsigned long long step_ns;
+
+	if (p->sched == LOOP_EVENT && speed > 0){
+		step_ns = (unsigned long long)(scp.a_t_x100 / speed) *
+			1000000000 / scp.t1_freq;
+		if (step_ns < scp.period_ns)
+			return step_ns;
+	}
+	return scp.period_ns;
+}
+
+/* move command from the options, started by the RT thread on its first period */
+static void move_command(struct motor_options *p)
+{
+	unsigned int accel, decel, speed, jerk;
+	struct rt_cmd cmd = { 0 };
+	int n;
+
+	accel = (unsigned int)(p->accel * ONE_TURN);
+	decel = (unsigned int)(p->decel * ONE_TURN);
+	speed = (unsigned int)(p->speed * ONE_TURN);
+	jerk = (unsigned int)(p->jerk * ONE_TURN);
+	srt.enabled = p->table;
+	cmd.axes = p->axes;
+	cmd.step[0] = (int)(p->turn * scp.spr);
+	for (n = 1; n < p->axes; n++)
+		cmd.step[n] = (int)(p->axis_turn[n] * scp.spr);
+	cmd.accel = accel;
+	cmd.decel = decel;
+	cmd.speed = speed;
+	cmd.jerk = jerk;
+	if (p->jog){
+		printf("speed_cntr_Velocity(%s, %d, %d, %d)\n",
+			cmd.step[0] < 0 ? "CCW" : "CW", accel, decel, speed);
+		cmd.type = RT_CMD_VELOCITY;
+	}
+	else if (p->segments > 1){
+		/* queue the move as segments, planned with look-ahead */
+		motion_queue_Init(p->blend);
+		for (n = 0; n < p->segments; n++){
+			/* spread the rounding over the segments */
+			int seg = cmd.step[0] * (n + 1) / p->segments - cmd.step[0] * n / p->segments;
+			if (seg != 0)
+				motion_queue_Add(seg, accel, decel, speed, jerk);
+		}
+		motion_queue_Plan();
+		printf("motion_queue_Next() x %d\n", motion_queue_Count());
+		cmd.type = RT_CMD_QUEUE;
+	}
+	else{
+		printf("multi_axis_Move(%d, [%d", p->axes, cmd.step[0]);
+		for (n = 1; n < p->axes; n++)
+			printf(", %d", cmd.step[n]);
+		printf("], %d, %d, %d, %d)\n", accel, decel, speed, jerk);
+		cmd.type = RT_CMD_MOVE;
+	}
+	rt_cmd_send(&cmd);
+}
+
+/*
+ * steps a dda burst emits per period at this step period, the first at
+ * the wakeup and the rest spaced by it within the spin window
+ */
+static int burst_steps(struct motor_options *p, long long step_ns)
+{
+	long long n = (long long)scp.period_ns * LOOP_BURST_SPIN_PCT / 100 / step_ns + 1;
+
+	return n < p->burst ? n : p->burst;
+}
+
+/*
+ * latency test verdict: a wakeup later than one loop period loses a
+ * timer tick with tick or dda scheduling, a wakeup later than the step period
+ * delays the next step with event scheduling
+ */
+static void latency_verdict(struct motor_options *p)
+{
+	unsigned int speed = (unsigned int)(p->speed * ONE_TURN);
+	long long step_ns, allowed_ns;
+
+	if (speed == 0 || wakeup_stats.count == 0)
+		return;
+	step_ns = (scp.a_t_x100 / speed) * 1000000000 / scp.t1_freq;
+	allowed_ns = p->sched == LOOP_EVENT ? step_ns : scp.period_ns;
+
+	printf("--------------------------------------------------\n");
+	printf(" Speed %4.4f turn/sec\n", p->speed);
+	printf("--------------------------------------------------\n");
+	printf("   step period : %lld ns\n", step_ns);
+	printf("   max allowed : %lld ns late\n", allowed_ns);
+	printf("      max seen : %lld ns late\n", wakeup_stats.max_ns);
+	if (p->sched == LOOP_DDA && p->burst > 1 &&
+	    step_ns * burst_steps(p, step_ns) < scp.period_ns)
+		printf("FAIL: %d steps per period, burst %d in %d%% of the loop period %u ns\n",
+			burst_steps(p, step_ns), p->burst,
+			LOOP_BURST_SPIN_PCT, scp.period_ns);
+	else if ((p->sched == LOOP_TICK ||
+		  (p->sched == LOOP_DDA && p->burst == 1)) &&
+		 step_ns < scp.period_ns)
+		printf("FAIL: step period below the loop period %u ns\n",
+			scp.period_ns);
+	else if (wakeup_stats.max_ns >= allowed_ns)
+		printf("FAIL: host misses step deadlines at this speed\n");
+	else
+		printf("PASS: host sustains this speed, margin %lld ns\n",
+			allowed_ns - wakeup_stats.max_ns);
+}
+
 int main(int argc, char* argv[])
 {
-        struct sched_param param;
         pthread_attr_t attr;
         pthread_t thread;
         int ret;
-	unsigned int accel, decel, speed;
 	int n;
 	struct motor_options p = { 
 		5.0, /* 5 turn */
 		1.0, /* accel = 1 turn/sec*sec */
 		1.0, /* decel = 1 turn/sec*sec */
-		1.0  /* speed = 1 turn/sec */
+		1.0, /* speed = 1 turn/sec */
+		LOOP_TICK, /* wake every period */
+		0,   /* ramp computed on-line */
+		1,   /* single axis */
+		{ 0 }, /* no more axes */
+		1,   /* one move */
+		1,   /* blend queued moves */
+		"port", /* parallel port output */
+		T1_FREQ, /* timer/counter frequency */
+		FSPR, /* full steps per round */
+		SPR_HALFSTEPS, /* step mode */
+		0.0, /* linear ramp */
+		0,   /* move turn */
+		NULL, /* no step trace */
+		"nanosleep", /* clock_nanosleep() */
+		RT_SCHED_FIFO, /* SCHED_FIFO prio 80 */
+		-1,  /* any cpu */
+		0.0, /* no latency test */
+		OVERRUN_CATCHUP, /* run missed periods back to back */
+		STEP_PULSE_NS, /* step pulse width */
+		STEP_DIR_SETUP_NS, /* direction setup */
+		0,   /* step on rising edge */
+		1    /* one step per dda period */
 	};
+	struct rt_event ev;
+	struct timespec start, stop, move_time;
+	struct timespec drain = { 0, 1000000 };
+	int done = false, progress_events = 0, step_count = 0, jog_eof = false;
 
 	if (!get_motor_options(argc, argv, &p)){
 		exit (0);
 	}
 
+	if (!rt_timer_valid(p.timer)){
+		printf("ERROR: Unknown timer: %s\n", p.timer);
+		exit (0);
+	}
+
+	if (!speed_cntr_Config(p.t1_freq, p.fspr, p.halfsteps)){
+		printf("ERROR: Invalid timer frequency %u Hz, %u steps/round%s\n",
+			p.t1_freq, p.fspr, p.halfsteps ? " halfsteps" : "");
+		exit (0);
+	}
+
+	/* step pulse is timed inside a loop period */
+	if (!p.dual_edge && p.pulse_ns + p.dir_setup_ns >= scp.period_ns){
+		printf("ERROR: Step pulse %lu ns and dir setup %lu ns exceed the loop period %u ns\n",
+			p.pulse_ns, p.dir_setup_ns, scp.period_ns);
+		exit (0);
+	}
+	stepPulseWidth = p.pulse_ns;
+	stepDirSetup = p.dir_setup_ns;
+	stepDualEdge = p.dual_edge;
+
 	printf("--------------------------------------------------\n");
 	printf(" Total number of turn : %4.4f \n", p.turn);
 	printf("         Acceleration : %4.4f turn/sec*sec\n", p.accel);
 	printf("        Decceleration : %4.4f turn/sec*sec\n", p.decel);
 	printf("                Speed : %4.4f turn/sec\n", p.speed);
+	if (p.jerk > 0)
+		printf("                 Jerk : %4.4f turn/sec^3 (S-curve)\n", p.jerk);
+	for (n = 1; n < p.axes; n++)
+		printf("      Axis %d num. turn : %4.4f \n", n, p.axis_turn[n]);
+	printf("           Scheduling : %s\n", sched_names[p.sched]);
+	if (p.sched == LOOP_DDA && p.burst > 1)
+		printf("                Burst : %d steps per period\n", p.burst);
+	printf("                Timer : %s\n", p.timer);
+	/* virtual time never sleeps, must not starve main() */
+	if (rt_timer_virtual(p.timer))
+		p.policy = RT_SCHED_OTHER;
+	rt_sched_cfg.policy = p.policy;
+	rt_sched_cfg.cpu = p.cpu;
+	if (p.policy == RT_SCHED_DEADLINE){
+		rt_sched_deadline(&rt_sched_cfg,
+			deadline_period_ns(&p, (unsigned int)(p.speed * ONE_TURN)));
+		printf("            RT policy : deadline, runtime %llu ns, period %llu ns\n",
+			rt_sched_cfg.runtime_ns, rt_sched_cfg.period_ns);
+	}
+	else if (p.policy == RT_SCHED_FIFO)
+		printf("            RT policy : fifo, prio %d\n", RT_SCHED_FIFO_PRIO);
+	else
+		printf("            RT policy : %s\n", rt_sched_name(p.policy));
+	if (p.cpu >= 0)
+		printf("               RT cpu : %d\n", p.cpu);
+	printf("              Overrun : %s\n", overrun_names[p.overrun]);
+	printf("           Ramp table : %s\n", p.table ? "yes" : "no");
+	if (p.latency_test > 0){
+		/* qualify the host, nothing is output */
+		p.output = "mem";
+		p.trace = NULL;
+	}
+	printf("               Output : %s\n", p.output);
+	if (p.trace)
+		printf("           Step trace : %s\n", p.trace);
+	printf("      Timer frequency : %u Hz\n", scp.t1_freq);
+	printf("      Steps per round : %u (%s)\n", scp.spr,
+		scp.halfsteps ? "halfsteps" : "fullsteps");
+	printf("          Loop period : %u ns (%u ticks)\n",
+		scp.period_ns, scp.period_ticks);
+	if (stepDualEdge)
+		printf("           Step pulse : dual edge, dir setup %lu ns\n",
+			stepDirSetup);
+	else
+		printf("           Step pulse : %lu ns, dir setup %lu ns\n",
+			stepPulseWidth, stepDirSetup);
+	if (p.jog)
+		printf("                  Jog : speeds from stdin, turn/sec\n");
+	if (p.segments > 1)
+		printf("             Segments : %d (%s)\n", p.segments,
+			p.blend ? "blended" : "stop at each");
 	printf("--------------------------------------------------\n");
 
+	latency_init(&wakeup_stats);
+	latency_init(&step_stats);
+
 	/* initialize, ie stop timer/counter, must be init before speed_cntr_Move */
 	speed_cntr_Init_Timer1();
 
-	/* Move motor */
-	total_steps = (unsigned int)(p.turn * SPR);
-	accel = (unsigned int)(p.accel * ONE_TURN);
-	decel = (unsigned int)(p.decel * ONE_TURN);
-	speed = (unsigned int)(p.speed * ONE_TURN);
-	printf("speed_cntr_Move(%d, %d, %d, %d)\n",
-		total_steps, accel, decel, speed);
-	speed_cntr_Move(total_steps, accel, decel, speed);
-
-	/* initialize parallel port */
-	printf("Parallel Port Interface (Base: 0x%x)\n", BASE);
-	
-	// Set permission bits of 4 ports starting from BASE
-	if (ioperm(BASE, 4, 1) != 0){
-		printf("ERROR: Could not set permissions on ports\n");
+	rt_channel_init();
+	if (p.latency_test > 0){
+		/* no move, the RT loop idles at its period */
+		printf("latency test %.1f sec\n", p.latency_test);
+	}
+	else
+		move_command(&p);
+
+	/* initialize output, parallel port by default */
+	if (!output_open(p.output)){
 		return 0;
 	}
 
-	/* initialize io port, must be init after parallel is initialized */
+	/* initialize io port, must be init after output is initialized */
 	sm_driver_Init_IO();
 
+	/* step trace, drained by a non RT thread */
+	if (p.trace && !step_trace_open(p.trace)){
+		output_close();
+		return 0;
+	}
+
 	/* ctrl-c handler */
 	signal(SIGINT, signalHandler);
 
         /* Lock memory */
         if(mlockall(MCL_CURRENT|MCL_FUTURE) == -1) {
                 printf("mlockall failed: %m\n");
-		// Clear permission bits of 4 ports starting from BASE
-		ioperm(BASE, 4, 0);
+		output_close();
                 exit(-2);
         }
 
@@ -217,45 +811,98 @@ int main(int argc, char* argv[])
 		goto out;
         }
  
-        /* Set scheduler policy and priority of pthread */
-        ret = pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        /* Set scheduler policy, priority and cpu of pthread */
+        ret = rt_sched_attr(&attr, &rt_sched_cfg);
         if (ret) {
-                printf("pthread setschedpolicy failed\n");
-                goto out;
-        }
-        param.sched_priority = 80;
-        ret = pthread_attr_setschedparam(&attr, &param);
-        if (ret) {
-                printf("pthread setschedparam failed\n");
-                goto out;
-        }
-        /* Use scheduling parameters of attr */
-        ret = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
-        if (ret) {
-                printf("pthread setinheritsched failed\n");
+                printf("pthread scheduling attributes failed\n");
                 goto out;
         }
  
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
         /* Create a pthread with specified attributes */
-        ret = pthread_create(&thread, &attr, simple_cyclic_task, NULL);
+        ret = pthread_create(&thread, &attr, simple_cyclic_task, &p);
         if (ret) {
                 printf("create pthread failed\n");
                 goto out;
         }
 
-	/* wait for rt_thread to start */
-	while (!rt_thread_started);
+	/* follow the move by its events until done or ctrl-c */
+	while (running && !done){
+		if (p.latency_test > 0){
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			timespec_diff(&start, &stop, &move_time);
+			if (move_time.tv_sec + move_time.tv_nsec * 1e-9 >= p.latency_test)
+				break;
+		}
+		while (rt_event_recv(&ev)){
+			switch (ev.type){
+				case RT_EVENT_PROGRESS:
+					progress_events++;
+					step_count = ev.step_count;
+					break;
+				case RT_EVENT_DONE:
+					step_count = ev.step_count;
+					done = true;
+					break;
+				case RT_EVENT_ERROR:
+					printf("RT error %d on command %d\n",
+						ev.value, ev.cmd);
+					break;
+			}
+		}
+		if (done)
+			break;
+		if (p.jog && !jog_eof)
+			jog_input(&jog_eof);
+		else
+			nanosleep(&drain, NULL);
+	}
+	running = false;
 
         /* Join the thread and wait until it is done */
         ret = pthread_join(thread, NULL);
         if (ret)
                 printf("join pthread failed: %m\n");
 
-	printf("total_step_count = %d\n", total_step_count);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	timespec_diff(&start, &stop, &move_time);
+
+	if (p.latency_test > 0){
+		latency_dump(&wakeup_stats, "Wakeup lateness");
+		latency_verdict(&p);
+		goto out;
+	}
+
+	printf("total_step_count = %d\n", step_count);
+	printf("progress events = %d (%lu dropped)\n", progress_events,
+		rt_eventq.ring.dropped);
+	printf("move time = %ld.%06ld sec\n",
+		(long)move_time.tv_sec, move_time.tv_nsec / 1000);
+	printf("overruns = %lu (%lu missed, %s)\n", overruns,
+		overrun_periods, overrun_names[p.overrun]);
+	if (rt_timer_virtual(p.timer) && done)
+		printf("virtual move time = %lld.%06lld sec\n",
+			(rt_done_ns - rt_start_ns) / 1000000000,
+			(rt_done_ns - rt_start_ns) % 1000000000 / 1000);
+	if (wakeup_stats.count){
+		printf("jitter (%s", rt_sched_name(p.policy));
+		if (p.cpu >= 0)
+			printf(", cpu %d", p.cpu);
+		printf(") = avg %lld ns, p99 %lld ns, max %lld ns\n",
+			wakeup_stats.sum_ns / (long long)wakeup_stats.count,
+			latency_percentile(&wakeup_stats, 99.0),
+			wakeup_stats.max_ns);
+	}
+	latency_dump(&wakeup_stats, "Wakeup lateness");
+	latency_dump(&step_stats, "Step edge error");
+	for (n = 0; n < mad.axes; n++)
+		printf("axis %d step_count = %d%s\n", n, mad.axis[n].step_count,
+			n == mad.master ? " (master)" : "");
  
 out:
-	// Clear permission bits of 4 ports starting from BASE
-	ioperm(BASE, 4, 0);
+	step_trace_close();
+	output_close();
         return ret;
 }
 
@@ -0,0 +1,192 @@
+/*This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief Look-ahead move queue.
+ *
+ * Moves are queued in a ring buffer and planned together, so the speed is
+ * carried over the junction between two moves instead of stopping after
+ * every move. The planner finds the highest entry and exit speed of every
+ * move that still lets the motor stop at the end of the last queued move.
+ *
+ * - File:               motion_queue.c
+ *****************************************************************************/
+#include <stdlib.h>
+#include "global.h"
+#include "sm_driver.h"
+#include "speed_cntr.h"
+#include "motion_queue.h"
+
+//! Contains queued moves.
+moveQueue mq;
+
+/*! \brief Init of move queue.
+ *
+ *  \param blend  Carry speed over junctions between moves.
+ */
+void motion_queue_Init(unsigned char blend)
+{
+  mq.head = 0;
+  mq.tail = 0;
+  mq.exit = 0;
+  mq.blend = blend;
+  mq.prepared = FALSE;
+}
+
+/*! \brief Number of moves waiting in queue.
+ */
+unsigned char motion_queue_Count(void)
+{
+  return (mq.tail - mq.head) & MOTION_QUEUE_MASK;
+}
+
+/*! \brief Add a move to the queue.
+ *
+ *  The move stops at the end until motion_queue_Plan() is run again.
+ *
+ *  \param step  Number of steps to move (pos - CW, neg - CCW).
+ *  \param accel  Accelration to use, in 0.01*rad/sec^2.
+ *  \param decel  Decelration to use, in 0.01*rad/sec^2.
+ *  \param speed  Max speed, in 0.01*rad/sec.
+ *  \param jerk  Jerk, in 0.01*rad/sec^3, 0 for linear ramp.
+ *  \return  FALSE if queue is full.
+ */
+unsigned char motion_queue_Add(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk)
+{
+  moveData *m;
+
+  if(motion_queue_Count() == MOTION_QUEUE_MASK || step == 0){
+    return FALSE;
+  }
+  m = &mq.move[mq.tail];
+  m->step = step;
+  m->accel = accel;
+  m->decel = decel;
+  m->speed = speed;
+  m->jerk = jerk;
+  m->entry = 0;
+  m->exit = 0;
+  mq.tail = (mq.tail + 1) & MOTION_QUEUE_MASK;
+  return TRUE;
+}
+
+/*! \brief Max speed over the junction between two moves.
+ *
+ *  Same direction keeps the lowest max speed of the two, a reversal stops.
+ *  S-curve moves start and end standing still.
+ */
+static unsigned int motion_queue_Junction(moveData *a, moveData *b)
+{
+  if(!mq.blend || ((a->step < 0) != (b->step < 0)) || a->jerk || b->jerk){
+    return 0;
+  }
+  return min(a->speed, b->speed);
+}
+
+/*! \brief Speed reached from v over step steps with given accel/decel.
+ *
+ *  v^2 = v0^2 + 2*alpha*accel*step
+ */
+static unsigned int motion_queue_Reach(unsigned int v, unsigned int accel, signed int step)
+{
+  return my_sqrt((long)v*v + ((long)scp.a_x20000*accel)/100*abs(step));
+}
+
+/*! \brief Plan entry and exit speed of all queued moves.
+ *
+ *  Backward pass from the last move, which must stop, limits every entry
+ *  speed to what can be decelerated to the next entry speed. Forward pass
+ *  from the running move limits every exit speed to what can be reached
+ *  by accelerating from the entry speed.
+ */
+void motion_queue_Plan(void)
+{
+  unsigned char i, n, k;
+  unsigned int v;
+  moveData *m;
+
+  // Speeds change, plan the next move again.
+  mq.prepared = FALSE;
+  n = motion_queue_Count();
+  if(n == 0){
+    return;
+  }
+
+  // Backward pass.
+  v = 0;
+  i = (mq.tail - 1) & MOTION_QUEUE_MASK;
+  for(k = 0; k < n; k++){
+    m = &mq.move[i];
+    m->exit = v;
+    v = motion_queue_Reach(v, m->decel, m->step);
+    if(k < n - 1){
+      v = min(v, motion_queue_Junction(&mq.move[(i - 1) & MOTION_QUEUE_MASK], m));
+    }
+    m->entry = v;
+    i = (i - 1) & MOTION_QUEUE_MASK;
+  }
+
+  // Forward pass, first move continues from the running one.
+  v = mq.exit;
+  i = mq.head;
+  for(k = 0; k < n; k++){
+    m = &mq.move[i];
+    m->entry = v;
+    v = min(m->exit, motion_queue_Reach(v, m->accel, m->step));
+    m->exit = v;
+    i = (i + 1) & MOTION_QUEUE_MASK;
+  }
+}
+
+/*! \brief Plan the next move in the speed controller.
+ *
+ *  Plans the move at head into the next move buffer of the speed
+ *  controller while the running move is executing, so motion_queue_Next()
+ *  only has to swap it in. The move stays in the queue until started.
+ *
+ *  \return  FALSE if queue is empty or the move is already planned.
+ */
+unsigned char motion_queue_Prepare(void)
+{
+  moveData *m;
+
+  if(mq.prepared || mq.head == mq.tail){
+    return FALSE;
+  }
+  m = &mq.move[mq.head];
+  if(m->jerk){
+    speed_cntr_Plan_SCurve(m->step, m->accel, m->decel, m->speed, m->jerk);
+  }
+  else{
+    speed_cntr_Plan_Blend(m->step, m->accel, m->decel, m->speed, m->entry, m->exit);
+  }
+  mq.prepared = TRUE;
+  return TRUE;
+}
+
+/*! \brief Start next move in queue.
+ *
+ *  Must be called when no move is running, or right after the running
+ *  move reached run_state STOP, before its STOP interrupt.
+ *  A move planned by motion_queue_Prepare() starts without any maths,
+ *  unless the plan was overwritten since, eg. by speed_cntr_Speed().
+ *
+ *  \return  FALSE if queue is empty.
+ */
+unsigned char motion_queue_Next(void)
+{
+  moveData *m;
+
+  if(mq.head == mq.tail){
+    return FALSE;
+  }
+  m = &mq.move[mq.head];
+  if(!mq.prepared || !speed_cntr_Ready()){
+    mq.prepared = FALSE;
+    motion_queue_Prepare();
+  }
+  speed_cntr_Start();
+  mq.prepared = FALSE;
+  mq.exit = m->exit;
+  mq.head = (mq.head + 1) & MOTION_QUEUE_MASK;
+  return TRUE;
+}
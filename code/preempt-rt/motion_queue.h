@@ -0,0 +1,66 @@
+/*This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief Header file for motion_queue.c.
+ *
+ * - File:               motion_queue.h
+ *****************************************************************************/
+
+#ifndef MOTION_QUEUE_H
+#define MOTION_QUEUE_H
+
+// Move queue size
+#define MOTION_QUEUE_SIZE 64 // 2,4,8,...,256 moves
+#define MOTION_QUEUE_MASK ( MOTION_QUEUE_SIZE - 1 )
+#if ( MOTION_QUEUE_SIZE & MOTION_QUEUE_MASK )
+  #error Motion queue size is not a power of 2
+#endif
+
+/*! \brief Holding data for one queued move.
+ *
+ *  Parameters as given to speed_cntr_Move(), plus the entry and exit
+ *  speeds found by motion_queue_Plan().
+ */
+typedef struct {
+  //! Number of steps to move (pos - CW, neg - CCW).
+  signed int step;
+  //! Accelration to use, in 0.01*rad/sec^2.
+  unsigned int accel;
+  //! Decelration to use, in 0.01*rad/sec^2.
+  unsigned int decel;
+  //! Max speed, in 0.01*rad/sec.
+  unsigned int speed;
+  //! Jerk, in 0.01*rad/sec^3, 0 for linear ramp.
+  unsigned int jerk;
+  //! Planned speed at start of move, in 0.01*rad/sec.
+  unsigned int entry;
+  //! Planned speed at end of move, in 0.01*rad/sec.
+  unsigned int exit;
+} moveData;
+
+/*! \brief Ring buffer of moves waiting to be run.
+ */
+typedef struct {
+  //! Next move to run.
+  unsigned char head;
+  //! Where next move is added.
+  unsigned char tail;
+  //! Carry speed over junctions, else every move stops.
+  unsigned char blend;
+  //! Exit speed of last started move, entry speed of next one.
+  unsigned int exit;
+  //! Move at head is planned in the speed controller, see motion_queue_Prepare().
+  unsigned char prepared;
+  moveData move[MOTION_QUEUE_SIZE];
+} moveQueue;
+
+void motion_queue_Init(unsigned char blend);
+unsigned char motion_queue_Add(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk);
+void motion_queue_Plan(void);
+unsigned char motion_queue_Prepare(void);
+unsigned char motion_queue_Next(void);
+unsigned char motion_queue_Count(void);
+
+extern moveQueue mq;
+
+#endif
@@ -0,0 +1,95 @@
+/*This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief Coordinated multi-axis linear moves.
+ *
+ * One speed ramp runs on the axis with most steps (the master), the other
+ * axes are interpolated from it with Bresenham/DDA, so all axes finish
+ * together and every axis is stepped from the same timer interrupt.
+ * Needs step clock mode in sm_driver.c, one clock pin per axis.
+ *
+ * - File:               multi_axis.c
+ *****************************************************************************/
+#include <stdlib.h>
+#include "global.h"
+#include "sm_driver.h"
+#include "speed_cntr.h"
+#include "multi_axis.h"
+
+//! Contains data for coordinated move.
+multiAxisData mad;
+
+/*! \brief Move several axes a given number of steps, on a straight line.
+ *
+ *  Starts the speed ramp on the axis with most steps, with the given
+ *  accel/decel/speed, and sets up the other axes to follow it.
+ *
+ *  \param axes  Number of axes, 1 to MAX_AXES.
+ *  \param step  Number of steps to move per axis (pos - CW, neg - CCW).
+ *  \param accel  Accelration to use on master axis, in 0.01*rad/sec^2.
+ *  \param decel  Decelration to use on master axis, in 0.01*rad/sec^2.
+ *  \param speed  Max speed of master axis, in 0.01*rad/sec.
+ *  \param jerk  Jerk of master axis, in 0.01*rad/sec^3, 0 for linear ramp.
+ */
+void multi_axis_Move(unsigned char axes, const signed int *step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk)
+{
+  unsigned char i;
+
+  if(axes > MAX_AXES){
+    axes = MAX_AXES;
+  }
+  mad.axes = axes;
+  mad.master = 0;
+  mad.master_delta = 0;
+
+  for(i = 0; i < axes; i++){
+    mad.axis[i].dir = (step[i] < 0) ? CCW : CW;
+    mad.axis[i].delta = abs(step[i]);
+    mad.axis[i].step_count = 0;
+    if(mad.axis[i].delta > mad.master_delta){
+      mad.master = i;
+      mad.master_delta = mad.axis[i].delta;
+    }
+  }
+
+  // Start slave steps half way, so they are centered between master steps.
+  for(i = 0; i < axes; i++){
+    mad.axis[i].error = mad.master_delta / 2;
+  }
+
+  // Master axis is stepped by the speed ramp.
+  stepAxis = mad.master;
+  speed_cntr_Move_SCurve(step[mad.master], accel, decel, speed, jerk);
+}
+
+/*! \brief Timer/Counter1 Output Compare A Match Interrupt, all axes.
+ *
+ *  Runs the master speed ramp, and for every master step, steps the
+ *  slave axes whose error term goes negative.
+ *
+ *  \return  Master axis direction when it stepped, NOACT otherwise.
+ */
+int multi_axis_TIMER1_COMPA_interrupt(void)
+{
+  unsigned char i;
+  int rc;
+
+  rc = speed_cntr_TIMER1_COMPA_interrupt();
+  if(rc == NOACT){
+    return rc;
+  }
+
+  mad.axis[mad.master].step_count++;
+  for(i = 0; i < mad.axes; i++){
+    if(i == mad.master){
+      continue;
+    }
+    mad.axis[i].error -= (signed int)mad.axis[i].delta;
+    if(mad.axis[i].error < 0){
+      mad.axis[i].error += mad.master_delta;
+      sm_driver_AxisStep(i, mad.axis[i].dir);
+      mad.axis[i].step_count++;
+    }
+  }
+  return rc;
+}
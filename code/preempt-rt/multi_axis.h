@@ -0,0 +1,48 @@
+/*This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief Header file for multi_axis.c.
+ *
+ * - File:               multi_axis.h
+ *****************************************************************************/
+
+#ifndef MULTI_AXIS_H
+#define MULTI_AXIS_H
+
+/*! \brief Holding data for one slave axis.
+ *
+ *  Slave axes follow the master axis speed ramp, a slave axis steps
+ *  when its Bresenham error term goes negative.
+ */
+typedef struct {
+  //! Direction axis should move.
+  unsigned char dir;
+  //! Number of steps to move.
+  unsigned int delta;
+  //! Bresenham error term, in master steps.
+  signed int error;
+  //! Counting steps when moving.
+  unsigned int step_count;
+} axisData;
+
+/*! \brief Holding data for a coordinated multi-axis linear move.
+ *
+ *  The axis with most steps is the master, it runs the speed ramp in srd.
+ */
+typedef struct {
+  //! Number of axes in move.
+  unsigned char axes;
+  //! Axis running the speed ramp.
+  unsigned char master;
+  //! Number of steps master axis moves.
+  unsigned int master_delta;
+  //! Per axis data, master included.
+  axisData axis[MAX_AXES];
+} multiAxisData;
+
+void multi_axis_Move(unsigned char axes, const signed int *step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk);
+int multi_axis_TIMER1_COMPA_interrupt(void);
+
+extern multiAxisData mad;
+
+#endif
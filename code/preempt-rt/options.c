@@ -2,8 +2,15 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "options.h"
+#include "motion_queue.h"
+#include "rt_timer.h"
+#include "rt_sched.h"
+
+const char *sched_names[] = { "tick", "event", "dda" };
+const char *overrun_names[] = { "catchup", "skip", "abort" };
 
 /* Flag set by --verbose */
 static int verbose_flag;
@@ -13,6 +20,24 @@ static void print_example(int argc, char **argv){
 	printf("EXAMPLE: \n");
 	printf("\n");
 	printf("    %s --turn 2.0 --accel 0.5 --decel 0.5 --speed 1.0\n", argv[0]);
+	printf("    %s --turn 2.0 --speed 1.0 --sched event\n", argv[0]);
+	printf("    %s --turn 5.0 --accel 4.0 --speed 2.0 --jerk 20.0\n", argv[0]);
+	printf("    %s --speed 1.0 --jog < speeds.txt\n", argv[0]);
+	printf("    %s --turn 2.0 --axis 1.0 --axis -0.5\n", argv[0]);
+	printf("    %s --turn 2.0 --speed 4.0 --segments 20\n", argv[0]);
+	printf("    %s --turn 2.0 --output file:steps.bin\n", argv[0]);
+	printf("    %s --turn 2.0 --trace trace.bin\n", argv[0]);
+	printf("    %s --turn 2.0 --sched event --timer hybrid:30\n", argv[0]);
+	printf("    %s --turn 5000.0 --timer virtual --trace trace.bin\n", argv[0]);
+	printf("    %s --turn 2.0 --sched event --policy deadline\n", argv[0]);
+	printf("    %s --turn 2.0 --cpu 3\n", argv[0]);
+	printf("    %s --speed 4.0 --sched event --latency-test 60\n", argv[0]);
+	printf("    %s --speed 20.0 --freq 460750 --sched event --latency-test 60\n", argv[0]);
+	printf("    %s --turn 2.0 --freq 460750 --fspr 200 --halfstep --sched event\n", argv[0]);
+	printf("    %s --turn 5.0 --speed 8.0 --freq 460750 --sched dda\n", argv[0]);
+	printf("    %s --turn 20.0 --speed 30.0 --freq 460750 --sched dda --burst 4\n", argv[0]);
+	printf("    %s --turn 2.0 --speed 8.0 --pulse 5000 --dir-setup 2000\n", argv[0]);
+	printf("    %s --turn 2.0 --speed 8.0 --dual-edge\n", argv[0]);
 	printf("\n");
 }
 
@@ -27,12 +52,65 @@ static void print_usage(int argc, char **argv){
 	printf("    -a, --accel        acceleration turn/sec*sec\n");
 	printf("    -d, --decel        decceleration turn/sec*sec\n");
 	printf("    -s, --speed        maximum speed turn/sec\n");
+	printf("    -j, --jerk         S-curve ramp with jerk turn/sec^3,\n");
+	printf("                       0 (default) for linear ramp\n");
+	printf("    -J, --jog          run at speed, read new speeds turn/sec\n");
+	printf("                       from stdin, 0 or end of input stops,\n");
+	printf("                       direction from the sign of turn\n");
+	printf("    -m, --sched        RT loop scheduling: tick (default), event\n");
+	printf("                       or dda (tick, steps keep the fraction of\n");
+	printf("                       a period, use with a higher --freq)\n");
+	printf("    -b, --burst        most steps per period with --sched dda,\n");
+	printf("                       up to %d (default 1), spaced by spinning\n",
+		LOOP_BURST_MAX);
+	printf("                       in the first %d%% of the period\n",
+		LOOP_BURST_SPIN_PCT);
+	printf("    -w, --timer        RT loop sleep: nanosleep (default), timerfd,\n");
+	printf("                       posix (timer signal to RT thread),\n");
+	printf("                       hybrid[:us] (sleep, spin last us, default %d)\n",
+		RT_TIMER_SPIN_US);
+	printf("                       or virtual (no sleep, simulated time,\n");
+	printf("                       runs with policy other)\n");
+	printf("    -P, --policy       RT thread scheduling: fifo (default, prio %d),\n",
+		RT_SCHED_FIFO_PRIO);
+	printf("                       other (no RT priority) or deadline,\n");
+	printf("                       deadline runtime is %d%% of the loop\n",
+		RT_SCHED_DL_RUNTIME_PCT);
+	printf("                       period, or of the step period at speed\n");
+	printf("                       with --sched event\n");
+	printf("    -c, --cpu          pin the RT thread to this CPU, deadline\n");
+	printf("                       needs an exclusive cpuset for it\n");
+	printf("    -O, --overrun      wakeup past the next deadline: catchup\n");
+	printf("                       (default, run missed periods at once),\n");
+	printf("                       skip (drop them) or abort (skip and\n");
+	printf("                       decelerate to stop)\n");
+	printf("    -L, --latency-test run the RT loop idle this number of sec,\n");
+	printf("                       no output, report wakeup lateness and\n");
+	printf("                       whether speed is sustainable\n");
+	printf("    -r, --ramp-table   precompute accel/decel step delays in move\n");
+	printf("    -y, --axis         add an axis moving this number of turn,\n");
+	printf("                       interpolated on the axis with most turns\n");
+	printf("    -S, --segments     split turn in this number of queued moves\n");
+	printf("    -B, --no-blend     stop at the end of every queued move\n");
+	printf("    -o, --output       port (default), mem (capture in memory)\n");
+	printf("                       or file:<name> (binary trace file)\n");
+	printf("    -T, --trace        record every step to this binary file\n");
+	printf("    -f, --freq         timer/counter frequency Hz\n");
+	printf("    -n, --fspr         motor full steps per round\n");
+	printf("    -H, --halfstep     use halfsteps\n");
+	printf("    -F, --fullstep     use fullsteps\n");
+	printf("    -p, --pulse        step pulse width ns (default %d)\n",
+		STEP_PULSE_NS);
+	printf("    -D, --dir-setup    direction to step edge setup time ns\n");
+	printf("                       (default %d)\n", STEP_DIR_SETUP_NS);
+	printf("    -E, --dual-edge    step on both clock edges, no pulse, for\n");
+	printf("                       drivers that accept it\n");
 	printf("\n");
 }
 
 int get_motor_options(int argc, char **argv, struct motor_options *p)
 {
-	int c;
+	int c, n;
 	char *endptr;
 
 	if (argc == 1){
@@ -49,13 +127,35 @@ int get_motor_options(int argc, char **argv, struct motor_options *p)
 			{"accel", required_argument, 0, 'a'},
 			{"decel", required_argument, 0, 'd'},
 			{"speed", required_argument, 0, 's'},
+			{"jerk", required_argument, 0, 'j'},
+			{"jog", no_argument, 0, 'J'},
+			{"sched", required_argument, 0, 'm'},
+			{"burst", required_argument, 0, 'b'},
+			{"timer", required_argument, 0, 'w'},
+			{"policy", required_argument, 0, 'P'},
+			{"cpu", required_argument, 0, 'c'},
+			{"overrun", required_argument, 0, 'O'},
+			{"latency-test", required_argument, 0, 'L'},
+			{"ramp-table", no_argument, 0, 'r'},
+			{"axis", required_argument, 0, 'y'},
+			{"segments", required_argument, 0, 'S'},
+			{"no-blend", no_argument, 0, 'B'},
+			{"output", required_argument, 0, 'o'},
+			{"trace", required_argument, 0, 'T'},
+			{"freq", required_argument, 0, 'f'},
+			{"fspr", required_argument, 0, 'n'},
+			{"halfstep", no_argument, 0, 'H'},
+			{"fullstep", no_argument, 0, 'F'},
+			{"pulse", required_argument, 0, 'p'},
+			{"dir-setup", required_argument, 0, 'D'},
+			{"dual-edge", no_argument, 0, 'E'},
 			{0, 0, 0, 0}
 		};
 
 		/* getopt_long stores the option index here. */
 		int option_index = 0;
 
-		c = getopt_long (argc, argv, "hx:t:a:d:s:", long_options, &option_index);
+		c = getopt_long (argc, argv, "hx:t:a:d:s:j:Jm:b:w:P:c:O:L:ry:S:Bo:T:f:n:HFp:D:E", long_options, &option_index);
 
 		/* Detect the end of the options. */
 		if (c == -1)
@@ -98,6 +198,133 @@ int get_motor_options(int argc, char **argv, struct motor_options *p)
 				p->speed = atof(optarg);
 				break;
 
+			case 'j':
+				p->jerk = atof(optarg);
+				break;
+
+			case 'J':
+				p->jog = 1;
+				break;
+
+			case 'm':
+				for (n = 0; n < 3; n++)
+					if (!strcmp(optarg, sched_names[n]))
+						break;
+				if (n == 3){
+					printf("\nUnknown scheduling: %s\n", optarg);
+					print_usage(argc, argv);
+					return 0;
+				}
+				p->sched = n;
+				break;
+
+			case 'b':
+				p->burst = atoi(optarg);
+				if (p->burst < 1 || p->burst > LOOP_BURST_MAX){
+					printf("\nInvalid burst: %s, 1 to %d\n",
+						optarg, LOOP_BURST_MAX);
+					return 0;
+				}
+				break;
+
+			case 'w':
+				p->timer = optarg;
+				break;
+
+			case 'P':
+				p->policy = rt_sched_parse(optarg);
+				if (p->policy < 0){
+					printf("\nUnknown policy: %s\n", optarg);
+					print_usage(argc, argv);
+					return 0;
+				}
+				break;
+
+			case 'c':
+				p->cpu = strtol(optarg, &endptr, 0);
+				if (*endptr || p->cpu < 0 ||
+						p->cpu >= sysconf(_SC_NPROCESSORS_ONLN)){
+					printf("\nInvalid cpu: %s\n", optarg);
+					return 0;
+				}
+				break;
+
+			case 'O':
+				for (n = 0; n < 3; n++)
+					if (!strcmp(optarg, overrun_names[n]))
+						break;
+				if (n == 3){
+					printf("\nUnknown overrun policy: %s\n", optarg);
+					print_usage(argc, argv);
+					return 0;
+				}
+				p->overrun = n;
+				break;
+
+			case 'L':
+				p->latency_test = atof(optarg);
+				break;
+
+			case 'r':
+				p->table = 1;
+				break;
+
+			case 'y':
+				if (p->axes >= MAX_AXES){
+					printf("\nToo many axes, max %d\n", MAX_AXES);
+					return 0;
+				}
+				p->axis_turn[p->axes++] = atof(optarg);
+				break;
+
+			case 'S':
+				p->segments = atoi(optarg);
+				if (p->segments < 1 || p->segments > MOTION_QUEUE_SIZE - 1){
+					printf("\nSegments must be 1 to %d\n", MOTION_QUEUE_SIZE - 1);
+					return 0;
+				}
+				break;
+
+			case 'B':
+				p->blend = 0;
+				break;
+
+			case 'o':
+				p->output = optarg;
+				break;
+
+			case 'T':
+				p->trace = optarg;
+				break;
+
+			case 'f':
+				p->t1_freq = strtoul(optarg, &endptr, 0);
+				break;
+
+			case 'n':
+				p->fspr = strtoul(optarg, &endptr, 0);
+				break;
+
+			case 'H':
+				p->halfsteps = 1;
+				break;
+
+			case 'F':
+				p->halfsteps = 0;
+				break;
+
+			case 'p':
+				p->pulse_ns = strtoul(optarg, &endptr, 0);
+				break;
+
+			case 'D':
+				p->dir_setup_ns = strtoul(optarg, &endptr, 0);
+				break;
+
+			case 'E':
+				p->dual_edge = 1;
+				break;
+
 			case '?':
 				/* getopt_long already printed an error message. */
 				break;
@@ -113,6 +340,11 @@ int get_motor_options(int argc, char **argv, struct motor_options *p)
 	   and ‘--brief’ as they are encountered,
 	   we report the final status resulting from them. */
 
+	if (p->burst > 1 && p->sched != LOOP_DDA){
+		printf("\n--burst needs --sched dda\n");
+		return 0;
+	}
+
 	if (verbose_flag)
 		puts ("verbose flag is set");
 
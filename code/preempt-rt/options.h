@@ -1,11 +1,53 @@
 #ifndef OPTIONS_H
 #define OPTIONS_H
 
+#include "sm_driver.h"
+
+// RT loop scheduling
+#define LOOP_TICK	0	/* wake every period, count timer ticks */
+#define LOOP_EVENT	1	/* sleep straight to the next step edge */
+#define LOOP_DDA	2	/* tick, carry the ticks past each step edge */
+
+// Most steps of a dda period, spaced by step_delay, and how far into
+// the period the burst may spin
+#define LOOP_BURST_MAX		8
+#define LOOP_BURST_SPIN_PCT	75
+
+// RT loop deadline overrun policy
+#define OVERRUN_CATCHUP	0	/* run the missed periods back to back */
+#define OVERRUN_SKIP	1	/* drop them, re-anchor the deadlines */
+#define OVERRUN_ABORT	2	/* skip and decelerate to stop */
+
+extern const char *sched_names[];
+extern const char *overrun_names[];
+
 struct motor_options{
 	float turn;
 	float accel;
 	float decel;
 	float speed;
+	int sched;
+	int table;
+	int axes;			/* number of axes, at least 1 */
+	float axis_turn[MAX_AXES];	/* turns of axis 1.., axis 0 uses turn */
+	int segments;			/* split turn in this number of moves */
+	int blend;			/* carry speed between segments */
+	const char *output;		/* port, mem or file:<name> */
+	unsigned int t1_freq;		/* timer/counter frequency in Hz */
+	unsigned int fspr;		/* full steps per round */
+	int halfsteps;			/* halfstep mode */
+	float jerk;			/* S-curve jerk, 0 for linear ramp */
+	int jog;			/* velocity mode, speeds from stdin */
+	const char *trace;		/* step trace file, or NULL */
+	const char *timer;		/* RT loop timing backend */
+	int policy;			/* RT thread scheduling, see rt_sched.h */
+	int cpu;			/* pin RT thread to this CPU, -1 for none */
+	float latency_test;		/* idle RT loop this many sec, 0 to move */
+	int overrun;			/* deadline overrun policy */
+	unsigned long pulse_ns;		/* step pulse width */
+	unsigned long dir_setup_ns;	/* direction to step edge setup */
+	int dual_edge;			/* step on both clock edges */
+	int burst;			/* most steps per dda period */
 };
 
 int get_motor_options(int argc, char **argv, struct motor_options *p);
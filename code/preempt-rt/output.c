@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/io.h>
+
+#include "sm_driver.h"
+#include "rt_channel.h"
+#include "rt_timer.h"
+#include "output.h"
+
+/* records in the trace ring, power of 2, 1s at 64k steps/s, 2 writes each */
+#define TRACE_RING_SIZE		(1 << 17)
+
+/* records written per fwrite() */
+#define TRACE_BATCH		1024
+
+/* drain period in ns, a quarter of the ring at 64k steps/s */
+#define TRACE_DRAIN_NS		250000000
+
+/*
+ * real parallel port
+ */
+static int port_open(const char *arg)
+{
+	(void)arg;
+	printf("Parallel Port Interface (Base: 0x%x)\n", BASE);
+
+	// Set permission bits of 4 ports starting from BASE
+	if (ioperm(BASE, 4, 1) != 0){
+		printf("ERROR: Could not set permissions on ports\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void port_write(unsigned char value)
+{
+	outb(value, BASE);
+}
+
+static void port_close(void)
+{
+	// Clear permission bits of 4 ports starting from BASE
+	ioperm(BASE, 4, 0);
+}
+
+/*
+ * in-memory capture buffer
+ */
+unsigned char output_capture[OUTPUT_CAPTURE_SIZE];
+unsigned long output_capture_len;
+unsigned long output_capture_lost;
+
+static int mem_open(const char *arg)
+{
+	(void)arg;
+	output_capture_len = 0;
+	output_capture_lost = 0;
+	/* no page faults in the RT loop */
+	memset(output_capture, 0, sizeof(output_capture));
+	return 1;
+}
+
+static void mem_write(unsigned char value)
+{
+	if (output_capture_len < OUTPUT_CAPTURE_SIZE)
+		output_capture[output_capture_len++] = value;
+	else
+		output_capture_lost++;
+}
+
+static void mem_close(void)
+{
+	printf("captured %lu port writes", output_capture_len);
+	if (output_capture_lost)
+		printf(", %lu lost", output_capture_lost);
+	printf("\n");
+}
+
+/*
+ * binary trace file of struct output_trace_record
+ * the RT thread appends every write to a lock-free ring, a normal
+ * priority thread drains it to the file
+ */
+static FILE *trace_file;
+static struct rt_ring trace_ring;
+static struct output_trace_record trace_entry[TRACE_RING_SIZE];
+static pthread_t trace_thread;
+static atomic_int trace_stop;
+static unsigned long trace_count;
+
+/* write everything in the ring, return number of records */
+static int trace_drain(void)
+{
+	static struct output_trace_record batch[TRACE_BATCH];
+	int i, n = 0, total = 0;
+
+	while ((i = rt_ring_peek(&trace_ring)) >= 0){
+		batch[n++] = trace_entry[i];
+		rt_ring_release(&trace_ring);
+		if (n == TRACE_BATCH){
+			fwrite(batch, sizeof(batch[0]), n, trace_file);
+			total += n;
+			n = 0;
+		}
+	}
+	if (n)
+		fwrite(batch, sizeof(batch[0]), n, trace_file);
+	return total + n;
+}
+
+static void *trace_task(void *data)
+{
+	struct timespec period = { 0, TRACE_DRAIN_NS };
+
+	(void)data;
+
+	while (!atomic_load(&trace_stop)){
+		trace_count += trace_drain();
+		nanosleep(&period, NULL);
+	}
+	/* the RT thread has stopped, take the rest */
+	trace_count += trace_drain();
+	return NULL;
+}
+
+/* drain thread with the default (non RT) scheduling of the caller */
+static int file_open(const char *arg)
+{
+	if (arg == NULL || *arg == '\0'){
+		printf("ERROR: file output needs a name, file:<name>\n");
+		return 0;
+	}
+	trace_file = fopen(arg, "wb");
+	if (trace_file == NULL){
+		printf("ERROR: Could not open %s: %m\n", arg);
+		return 0;
+	}
+	/* no page faults in the RT loop */
+	memset(trace_entry, 0, sizeof(trace_entry));
+	rt_ring_init(&trace_ring, TRACE_RING_SIZE);
+	trace_count = 0;
+	atomic_store(&trace_stop, 0);
+	if (pthread_create(&trace_thread, NULL, trace_task, NULL)){
+		printf("ERROR: Could not start output thread\n");
+		fclose(trace_file);
+		return 0;
+	}
+	return 1;
+}
+
+/* constant time, no file I/O, dropped when the ring is full */
+static void file_write(unsigned char value)
+{
+	struct output_trace_record *r;
+	struct timespec t;
+	int i;
+
+	i = rt_ring_reserve(&trace_ring);
+	if (i < 0)
+		return;
+	rt_timer_now(&t);
+	r = &trace_entry[i];
+	r->t_ns = (long long)t.tv_sec * 1000000000 + t.tv_nsec;
+	r->value = value;
+	rt_ring_commit(&trace_ring);
+}
+
+/* must be called after the RT thread has stopped */
+static void file_close(void)
+{
+	atomic_store(&trace_stop, 1);
+	pthread_join(trace_thread, NULL);
+	fclose(trace_file);
+	trace_file = NULL;
+	printf("written %lu port writes", trace_count);
+	if (trace_ring.dropped)
+		printf(", %lu dropped", trace_ring.dropped);
+	printf("\n");
+}
+
+static const struct output_backend backends[] = {
+	{ "port", port_open, port_write, port_close },
+	{ "mem", mem_open, mem_write, mem_close },
+	{ "file", file_open, file_write, file_close },
+};
+
+/* until output_open(), writes are captured in memory */
+const struct output_backend *output = &backends[1];
+
+/*
+ * select and open backend from spec "port", "mem" or "file:<name>"
+ * return 0 on error
+ */
+int output_open(const char *spec)
+{
+	const char *arg = strchr(spec, ':');
+	size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+	unsigned int n;
+
+	for (n = 0; n < sizeof(backends)/sizeof(backends[0]); n++){
+		if (strlen(backends[n].name) == len &&
+		    !strncmp(backends[n].name, spec, len)){
+			if (!backends[n].open(arg ? arg + 1 : NULL))
+				return 0;
+			output = &backends[n];
+			return 1;
+		}
+	}
+	printf("ERROR: Unknown output: %s\n", spec);
+	return 0;
+}
+
+void output_close(void)
+{
+	output->close();
+}
@@ -0,0 +1,44 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+/* size of the in-memory capture buffer, in port writes */
+#define OUTPUT_CAPTURE_SIZE	(1 << 20)
+
+/*
+ * output backend for the stepper motor port,
+ * selected at runtime with output_open()
+ */
+struct output_backend {
+	const char *name;
+	/* arg is the text after ':' in the output spec, or NULL */
+	int (*open)(const char *arg);
+	void (*write)(unsigned char value);
+	void (*close)(void);
+};
+
+/*
+ * binary trace file record, one per port write, time from
+ * rt_timer_now(), CLOCK_MONOTONIC until the RT loop opens its timer
+ */
+struct output_trace_record {
+	long long t_ns;		/* rt_timer_now() */
+	unsigned char value;	/* port value */
+	unsigned char pad[7];
+};
+
+extern const struct output_backend *output;
+
+/* in-memory capture buffer, filled by the "mem" backend */
+extern unsigned char output_capture[OUTPUT_CAPTURE_SIZE];
+extern unsigned long output_capture_len;
+extern unsigned long output_capture_lost;
+
+int output_open(const char *spec);
+void output_close(void);
+
+static inline void output_write(unsigned char value)
+{
+	output->write(value);
+}
+
+#endif
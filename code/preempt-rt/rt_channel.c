@@ -0,0 +1,29 @@
+/*
+ * Command and event queues between main() and the RT thread
+ * lock-free single producer/single consumer rings, neither side
+ * ever blocks, a full queue drops the entry and counts it
+ */
+
+#include <string.h>
+#include "rt_channel.h"
+
+/* main() to RT thread */
+struct rt_cmd_queue rt_cmdq;
+/* RT thread to main() */
+struct rt_event_queue rt_eventq;
+
+/* size must be a power of 2 */
+void rt_ring_init(struct rt_ring *r, unsigned int size)
+{
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	r->dropped = 0;
+	r->size = size;
+}
+
+/* must be called before the RT thread is started */
+void rt_channel_init(void)
+{
+	rt_ring_init(&rt_cmdq.ring, RT_CHANNEL_SIZE);
+	rt_ring_init(&rt_eventq.ring, RT_CHANNEL_SIZE);
+}
@@ -0,0 +1,173 @@
+#ifndef RT_CHANNEL_H
+#define RT_CHANNEL_H
+
+#include <stdatomic.h>
+#include "sm_driver.h"
+
+/* entries per queue, power of 2 */
+#define RT_CHANNEL_SIZE	256
+#define RT_CHANNEL_MASK	(RT_CHANNEL_SIZE - 1)
+#if (RT_CHANNEL_SIZE & RT_CHANNEL_MASK)
+#error RT channel size is not a power of 2
+#endif
+
+/* commands, main() to RT thread */
+#define RT_CMD_MOVE	0	/* multi_axis_Move() */
+#define RT_CMD_QUEUE	1	/* run the planned motion queue */
+#define RT_CMD_STOP	2	/* stop now, flush motion queue */
+#define RT_CMD_SPEED	3	/* new speed of running move, 0 stops */
+#define RT_CMD_VELOCITY	4	/* run at speed until speed 0 */
+
+/* events, RT thread to main() */
+#define RT_EVENT_PROGRESS 0	/* master axis steps so far, coalesced */
+#define RT_EVENT_DONE	1	/* last move stopped */
+#define RT_EVENT_ERROR	2	/* command refused */
+
+/* error codes of RT_EVENT_ERROR */
+#define RT_ERR_BUSY	1	/* move command while moving */
+#define RT_ERR_SPEED	2	/* speed not changed */
+#define RT_ERR_CMD	3	/* unknown command */
+#define RT_ERR_TIMER	4	/* timer backend failed to open */
+#define RT_ERR_SCHED	5	/* scheduling policy refused */
+#define RT_ERR_OVERRUN	6	/* move aborted on deadline overrun */
+
+/* least time between RT_EVENT_PROGRESS, main() drains every 1 ms */
+#define RT_PROGRESS_NS	1000000
+
+struct rt_cmd {
+	int type;
+	int axes;
+	int step[MAX_AXES];
+	unsigned int accel;
+	unsigned int decel;
+	unsigned int speed;
+	unsigned int jerk;
+};
+
+struct rt_event {
+	int type;
+	int value;		/* last step direction, or error code */
+	int step_count;		/* master axis steps of the move */
+	int cmd;		/* command type of an error */
+};
+
+/*
+ * single producer/single consumer ring indexes, free running,
+ * each written by one side only and on its own cache line
+ */
+struct rt_ring {
+	_Atomic unsigned int head __attribute__((aligned(64)));	/* consumer */
+	_Atomic unsigned int tail __attribute__((aligned(64)));	/* producer */
+	unsigned long dropped;		/* producer, entries not sent */
+	unsigned int size;		/* entries, power of 2 */
+};
+
+struct rt_cmd_queue {
+	struct rt_ring ring;
+	struct rt_cmd entry[RT_CHANNEL_SIZE];
+};
+
+struct rt_event_queue {
+	struct rt_ring ring;
+	struct rt_event entry[RT_CHANNEL_SIZE];
+};
+
+extern struct rt_cmd_queue rt_cmdq;
+extern struct rt_event_queue rt_eventq;
+
+void rt_ring_init(struct rt_ring *r, unsigned int size);
+void rt_channel_init(void);
+
+/* producer: no free slot, not counted as dropped */
+static inline int rt_ring_full(struct rt_ring *r)
+{
+	return atomic_load_explicit(&r->tail, memory_order_relaxed) -
+		atomic_load_explicit(&r->head, memory_order_acquire) >= r->size;
+}
+
+/* producer: slot to fill, or -1 when full */
+
+static inline int rt_ring_reserve(struct rt_ring *r)
+{
+	unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	if (tail - atomic_load_explicit(&r->head, memory_order_acquire) >=
+			r->size){
+		r->dropped++;
+		return -1;
+	}
+	return tail & (r->size - 1);
+}
+
+/* producer: publish the reserved slot */
+static inline void rt_ring_commit(struct rt_ring *r)
+{
+	unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/* consumer: slot to read, or -1 when empty */
+static inline int rt_ring_peek(struct rt_ring *r)
+{
+	unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	if (head == atomic_load_explicit(&r->tail, memory_order_acquire))
+		return -1;
+	return head & (r->size - 1);
+}
+
+/* consumer: give the read slot back to the producer */
+static inline void rt_ring_release(struct rt_ring *r)
+{
+	unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* wait-free send and receive, return 0 when full or empty */
+static inline int rt_cmd_send(const struct rt_cmd *c)
+{
+	int i = rt_ring_reserve(&rt_cmdq.ring);
+
+	if (i < 0)
+		return 0;
+	rt_cmdq.entry[i] = *c;
+	rt_ring_commit(&rt_cmdq.ring);
+	return 1;
+}
+
+static inline int rt_cmd_recv(struct rt_cmd *c)
+{
+	int i = rt_ring_peek(&rt_cmdq.ring);
+
+	if (i < 0)
+		return 0;
+	*c = rt_cmdq.entry[i];
+	rt_ring_release(&rt_cmdq.ring);
+	return 1;
+}
+
+static inline int rt_event_send(const struct rt_event *e)
+{
+	int i = rt_ring_reserve(&rt_eventq.ring);
+
+	if (i < 0)
+		return 0;
+	rt_eventq.entry[i] = *e;
+	rt_ring_commit(&rt_eventq.ring);
+	return 1;
+}
+
+static inline int rt_event_recv(struct rt_event *e)
+{
+	int i = rt_ring_peek(&rt_eventq.ring);
+
+	if (i < 0)
+		return 0;
+	*e = rt_eventq.entry[i];
+	rt_ring_release(&rt_eventq.ring);
+	return 1;
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Scheduling of the RT thread
+ * SCHED_FIFO is set in the pthread attributes, SCHED_DEADLINE has no
+ * pthread attribute and is set by the thread itself, with sched_setattr()
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "rt_sched.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE	6
+#endif
+
+/* glibc has no sched_setattr() wrapper, kernel layout of its argument */
+struct rt_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static const char *names[] = { "fifo", "deadline", "other" };
+
+/* policy from its name, -1 if unknown */
+int rt_sched_parse(const char *name)
+{
+	unsigned int n;
+
+	for (n = 0; n < sizeof(names) / sizeof(names[0]); n++)
+		if (!strcmp(name, names[n]))
+			return n;
+	return -1;
+}
+
+const char *rt_sched_name(int policy)
+{
+	return names[policy];
+}
+
+/*
+ * SCHED_DEADLINE reservation for an activation every period_ns,
+ * implicit deadline, ie deadline = period
+ */
+void rt_sched_deadline(struct rt_sched *s, unsigned long long period_ns)
+{
+	if (period_ns < RT_SCHED_DL_PERIOD_MIN_NS)
+		period_ns = RT_SCHED_DL_PERIOD_MIN_NS;
+	s->period_ns = period_ns;
+	s->deadline_ns = period_ns;
+	s->runtime_ns = period_ns * RT_SCHED_DL_RUNTIME_PCT / 100;
+}
+
+/* pthread attributes before pthread_create(), 0 or an errno */
+int rt_sched_attr(pthread_attr_t *attr, const struct rt_sched *s)
+{
+	struct sched_param param = { 0 };
+	cpu_set_t cpus;
+	int ret;
+
+	if (s->cpu >= 0){
+		CPU_ZERO(&cpus);
+		CPU_SET(s->cpu, &cpus);
+		ret = pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+		if (ret)
+			return ret;
+	}
+
+	/* deadline thread starts as SCHED_OTHER, see rt_sched_enter() */
+	if (s->policy == RT_SCHED_FIFO){
+		ret = pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+		param.sched_priority = RT_SCHED_FIFO_PRIO;
+	}
+	else
+		ret = pthread_attr_setschedpolicy(attr, SCHED_OTHER);
+	if (ret)
+		return ret;
+	ret = pthread_attr_setschedparam(attr, &param);
+	if (ret)
+		return ret;
+
+	/* Use scheduling parameters of attr */
+	return pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+}
+
+/*
+ * called first by the RT thread, 1 on success
+ * the kernel refuses SCHED_DEADLINE for a thread whose affinity is not
+ * its whole root domain, pin with an exclusive cpuset for that
+ */
+int rt_sched_enter(const struct rt_sched *s)
+{
+	struct rt_sched_attr attr = { 0 };
+
+	if (s->policy != RT_SCHED_DEADLINE)
+		return 1;
+
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	attr.sched_runtime = s->runtime_ns;
+	attr.sched_deadline = s->deadline_ns;
+	attr.sched_period = s->period_ns;
+	if (syscall(SYS_sched_setattr, 0, &attr, 0)){
+		printf("ERROR: sched_setattr(SCHED_DEADLINE) failed: %m\n");
+		return 0;
+	}
+	return 1;
+}
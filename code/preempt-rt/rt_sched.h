@@ -0,0 +1,35 @@
+#ifndef RT_SCHED_H
+#define RT_SCHED_H
+
+#include <pthread.h>
+
+/* RT thread scheduling policy */
+#define RT_SCHED_FIFO		0	/* SCHED_FIFO, fixed priority */
+#define RT_SCHED_DEADLINE	1	/* SCHED_DEADLINE, runtime every period */
+#define RT_SCHED_OTHER		2	/* SCHED_OTHER, no RT priority */
+
+/* SCHED_FIFO priority of the RT thread */
+#define RT_SCHED_FIFO_PRIO	80
+
+/*
+ * SCHED_DEADLINE reservation: runtime is this percent of the period,
+ * the kernel refuses periods below sched_deadline_period_min_us (100us)
+ */
+#define RT_SCHED_DL_RUNTIME_PCT	25
+#define RT_SCHED_DL_PERIOD_MIN_NS	100000
+
+struct rt_sched {
+	int policy;
+	int cpu;			/* pinned to this CPU, -1 for none */
+	unsigned long long runtime_ns;	/* SCHED_DEADLINE only */
+	unsigned long long deadline_ns;
+	unsigned long long period_ns;
+};
+
+int rt_sched_parse(const char *name);
+const char *rt_sched_name(int policy);
+void rt_sched_deadline(struct rt_sched *s, unsigned long long period_ns);
+int rt_sched_attr(pthread_attr_t *attr, const struct rt_sched *s);
+int rt_sched_enter(const struct rt_sched *s);
+
+#endif
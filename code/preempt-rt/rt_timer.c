@@ -0,0 +1,268 @@
+/*
+ * Timing backends of the RT loop
+ * rt_timer_open() must be called from the thread that sleeps,
+ * the posix timer signals that thread only
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+
+#include "rt_timer.h"
+
+static long long timespec_ns(const struct timespec *t)
+{
+	return (long long)t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+/* real time of every backend but virtual */
+static void monotonic_now(struct timespec *t)
+{
+	clock_gettime(CLOCK_MONOTONIC, t);
+}
+
+/* busy wait on real time, every backend but virtual */
+static void monotonic_spin_until(const struct timespec *t)
+{
+	struct timespec now;
+	long long deadline = timespec_ns(t);
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (timespec_ns(&now) < deadline);
+}
+
+/*
+ * clock_nanosleep(TIMER_ABSTIME)
+ */
+static int nanosleep_open(const char *arg)
+{
+	(void)arg;
+	return 1;
+}
+
+static void nanosleep_sleep_until(const struct timespec *t)
+{
+	/* for simplicity, ignoring possibilities of signal wakes */
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL);
+}
+
+static void nanosleep_close(void)
+{
+}
+
+/*
+ * timerfd, armed with the absolute deadline, read() blocks until it expires
+ */
+static int timer_fd = -1;
+
+static int timerfd_open(const char *arg)
+{
+	(void)arg;
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (timer_fd < 0){
+		printf("ERROR: timerfd_create failed: %m\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void timerfd_sleep_until(const struct timespec *t)
+{
+	struct itimerspec its = { { 0, 0 }, *t };
+	uint64_t expired;
+
+	/* a deadline in the past expires at once */
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+	if (read(timer_fd, &expired, sizeof(expired)) < 0)
+		return;
+}
+
+static void timerfd_close(void)
+{
+	close(timer_fd);
+	timer_fd = -1;
+}
+
+/*
+ * POSIX timer, SIGEV_THREAD_ID signal to the RT thread, taken
+ * with sigwaitinfo() so no handler runs
+ */
+static timer_t posix_timer;
+static sigset_t posix_set;
+
+static int posix_open(const char *arg)
+{
+	struct sigevent sev;
+
+	(void)arg;
+
+	sigemptyset(&posix_set);
+	sigaddset(&posix_set, SIGRTMIN);
+	pthread_sigmask(SIG_BLOCK, &posix_set, NULL);
+
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGRTMIN;
+#ifdef sigev_notify_thread_id
+	sev.sigev_notify_thread_id = syscall(SYS_gettid);
+#else
+	sev._sigev_un._tid = syscall(SYS_gettid);
+#endif
+	if (timer_create(CLOCK_MONOTONIC, &sev, &posix_timer)){
+		printf("ERROR: timer_create failed: %m\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void posix_sleep_until(const struct timespec *t)
+{
+	struct itimerspec its = { { 0, 0 }, *t };
+
+	timer_settime(posix_timer, TIMER_ABSTIME, &its, NULL);
+	sigwaitinfo(&posix_set, NULL);
+}
+
+static void posix_close(void)
+{
+	timer_delete(posix_timer);
+	pthread_sigmask(SIG_UNBLOCK, &posix_set, NULL);
+}
+
+/*
+ * hybrid, clock_nanosleep() until spin us before the deadline,
+ * then spin on the clock, trades CPU for wakeup latency
+ */
+static long long hybrid_spin_ns = RT_TIMER_SPIN_US * 1000LL;
+
+static int hybrid_open(const char *arg)
+{
+	if (arg){
+		hybrid_spin_ns = atol(arg) * 1000LL;
+		if (hybrid_spin_ns < 0){
+			printf("ERROR: Invalid spin time: %s us\n", arg);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void hybrid_sleep_until(const struct timespec *t)
+{
+	struct timespec wake;
+	long long wake_ns = timespec_ns(t) - hybrid_spin_ns;
+
+	wake.tv_sec = wake_ns / 1000000000;
+	wake.tv_nsec = wake_ns % 1000000000;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+	monotonic_spin_until(t);
+}
+
+static void hybrid_close(void)
+{
+}
+
+/*
+ * virtual, no sleep, the clock jumps to the deadline, runs the same
+ * RT loop as fast as the CPU allows, from time 0
+ */
+static struct timespec virtual_time;
+
+static int virtual_open(const char *arg)
+{
+	(void)arg;
+	virtual_time.tv_sec = 0;
+	virtual_time.tv_nsec = 0;
+	return 1;
+}
+
+/* sleep and spin alike */
+static void virtual_sleep_until(const struct timespec *t)
+{
+	/* a deadline in the past is on time */
+	if (timespec_ns(t) > timespec_ns(&virtual_time))
+		virtual_time = *t;
+}
+
+static void virtual_now(struct timespec *t)
+{
+	*t = virtual_time;
+}
+
+static void virtual_close(void)
+{
+}
+
+static const struct rt_timer_backend backends[] = {
+	{ "nanosleep", nanosleep_open, nanosleep_sleep_until, monotonic_now,
+		monotonic_spin_until, nanosleep_close },
+	{ "timerfd", timerfd_open, timerfd_sleep_until, monotonic_now,
+		monotonic_spin_until, timerfd_close },
+	{ "posix", posix_open, posix_sleep_until, monotonic_now,
+		monotonic_spin_until, posix_close },
+	{ "hybrid", hybrid_open, hybrid_sleep_until, monotonic_now,
+		monotonic_spin_until, hybrid_close },
+	{ "virtual", virtual_open, virtual_sleep_until, virtual_now,
+		virtual_sleep_until, virtual_close },
+};
+
+/* until rt_timer_open(), clock_nanosleep() */
+const struct rt_timer_backend *rt_timer = &backends[0];
+
+static const struct rt_timer_backend *rt_timer_find(const char *spec)
+{
+	const char *arg = strchr(spec, ':');
+	size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+	unsigned int n;
+
+	for (n = 0; n < sizeof(backends)/sizeof(backends[0]); n++)
+		if (strlen(backends[n].name) == len &&
+		    !strncmp(backends[n].name, spec, len))
+			return &backends[n];
+	return NULL;
+}
+
+/* check spec "nanosleep", "timerfd", "posix", "hybrid[:<us>]" or "virtual" */
+int rt_timer_valid(const char *spec)
+{
+	return rt_timer_find(spec) != NULL;
+}
+
+/* spec runs on virtual time, never sleeps */
+int rt_timer_virtual(const char *spec)
+{
+	const struct rt_timer_backend *b = rt_timer_find(spec);
+
+	return b && b->now == virtual_now;
+}
+
+/*
+ * select and open backend from spec, in the thread that will sleep
+ * return 0 on error
+ */
+int rt_timer_open(const char *spec)
+{
+	const struct rt_timer_backend *b = rt_timer_find(spec);
+	const char *arg = strchr(spec, ':');
+
+	if (b == NULL){
+		printf("ERROR: Unknown timer: %s\n", spec);
+		return 0;
+	}
+	if (!b->open(arg ? arg + 1 : NULL))
+		return 0;
+	rt_timer = b;
+	return 1;
+}
+
+void rt_timer_close(void)
+{
+	rt_timer->close();
+	rt_timer = &backends[0];
+}
@@ -0,0 +1,48 @@
+#ifndef RT_TIMER_H
+#define RT_TIMER_H
+
+#include <time.h>
+
+/* default spin time of the hybrid backend, in us */
+#define RT_TIMER_SPIN_US	50
+
+/*
+ * timing backend of the RT loop, sleeps until an absolute
+ * CLOCK_MONOTONIC deadline, selected at runtime with rt_timer_open()
+ * the RT loop reads the time with now(), a virtual clock for the
+ * virtual backend, and waits short times within a period with
+ * spin_until()
+ */
+struct rt_timer_backend {
+	const char *name;
+	/* arg is the text after ':' in the timer spec, or NULL */
+	int (*open)(const char *arg);
+	void (*sleep_until)(const struct timespec *t);
+	void (*now)(struct timespec *t);
+	void (*spin_until)(const struct timespec *t);
+	void (*close)(void);
+};
+
+extern const struct rt_timer_backend *rt_timer;
+
+int rt_timer_valid(const char *spec);
+int rt_timer_virtual(const char *spec);
+int rt_timer_open(const char *spec);
+void rt_timer_close(void);
+
+static inline void rt_timer_sleep_until(const struct timespec *t)
+{
+	rt_timer->sleep_until(t);
+}
+
+static inline void rt_timer_now(struct timespec *t)
+{
+	rt_timer->now(t);
+}
+
+static inline void rt_timer_spin_until(const struct timespec *t)
+{
+	rt_timer->spin_until(t);
+}
+
+#endif
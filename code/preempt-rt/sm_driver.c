@@ -20,9 +20,11 @@
  * $RCSfile: sm_driver.c,v $
  * $Date: 2006/05/08 12:25:58 $
  *****************************************************************************/
-#include <sys/io.h>
+#include <time.h>
 #include "global.h"
 #include "sm_driver.h"
+#include "output.h"
+#include "rt_timer.h"
 
 // Bit position for data in step table
 #define BIT_A1 3
@@ -31,12 +33,19 @@
 #define BIT_B2 0
 
 // io register
-unsigned char SM_PORT = 0;
+//! Shadow of the port register. The step bits of all axes due in a tick
+//! are gathered here, and written with one OUTB by sm_driver_Flush().
+static unsigned char smPortShadow = 0;
+//! Port value last written by sm_driver_Flush().
+static unsigned char smPortWritten = 0;
 unsigned char SM_DRIVE = 0;
 
 // step clock mode
 #define STEP_CLOCK_MODE	(1)
 #define CLOCK_PIN	(0)
+#define DIR_PIN		(CLOCK_PIN+MAX_AXES)
+#define CLOCK_MASK	(((1<<MAX_AXES)-1)<<CLOCK_PIN)
+#define DIR_MASK	(((1<<MAX_AXES)-1)<<DIR_PIN)
 
 //! Table with control signals for stepper motor
 /*__flash*/ unsigned char steptab[] = {((1<<BIT_A1) | (0<<BIT_A2) | (0<<BIT_B1) | (0<<BIT_B2)),
@@ -51,13 +60,31 @@ unsigned char SM_DRIVE = 0;
 //! Position of stepper motor (relative to starting position as zero)
 int stepPosition = 0;
 
+//! Axis moved by sm_driver_StepCounter(), the master axis of a multi-axis move
+unsigned char stepAxis = 0;
+
+//! Halfstep or fullstep mode, defaults to HALFSTEPS/FULLSTEPS
+#ifdef HALFSTEPS
+unsigned char stepHalfsteps = TRUE;
+#else
+unsigned char stepHalfsteps = FALSE;
+#endif
+
+//! Step pulse width, the clock pin is high this long after a rising edge.
+unsigned long stepPulseWidth = STEP_PULSE_NS;
+//! Time the direction pin is set before a step edge.
+unsigned long stepDirSetup = STEP_DIR_SETUP_NS;
+//! Step on rising and falling clock edges, for drivers that accept it.
+unsigned char stepDualEdge = FALSE;
+
 /*! \brief Init of io-pins for stepper motor.
  */
 void sm_driver_Init_IO(void)
 {
   // Init of IO pins
-  SM_PORT &= ~((1<<A1) | (1<<A2) | (1<<B1) | (1<<B2)); // Set output pin registers to zero
-  OUTB(SM_PORT);
+  smPortShadow &= ~((1<<A1) | (1<<A2) | (1<<B1) | (1<<B2)); // Set output pin registers to zero
+  smPortWritten = smPortShadow;
+  OUTB(smPortShadow);
   SM_DRIVE |= ((1<<A1) | (1<<A2) | (1<<B1) | (1<<B2)); // Set output pin direction registers to output
 }
 
@@ -74,8 +101,7 @@ void sm_driver_Init_IO(void)
 unsigned char sm_driver_StepCounter(signed char inc)
 {
 #ifdef STEP_CLOCK_MODE
-  SM_PORT = SM_PORT ^ (1<<CLOCK_PIN);
-  OUTB(SM_PORT);
+  sm_driver_AxisStep(stepAxis, inc);
   return 1;
 #else
   // Counts 0-1-...-6-7 in halfstep, 0-2-4-6 in fullstep
@@ -88,21 +114,22 @@ unsigned char sm_driver_StepCounter(signed char inc)
     stepPosition++;
   }
 
-#ifdef HALFSTEPS
-  if(inc){
-    counter++;
+  if(stepHalfsteps){
+    if(inc){
+      counter++;
+    }
+    else{
+      counter--;
+    }
   }
   else{
-    counter--;
+    if(inc){
+      counter += 2;
+    }
+    else{
+      counter -= 2;
+    }
   }
-#else
-  if(inc){
-    counter += 2;
-  }
-  else{
-    counter -= 2;
-  }
-#endif
 
   // Stay within the steptab
   counter &= 0x07;
@@ -111,6 +138,40 @@ unsigned char sm_driver_StepCounter(signed char inc)
 #endif /* STEP_CLOCK_MODE */
 }
 
+/*! \brief Move one axis one step.
+ *
+ *  In step clock mode every axis has its own clock and direction pin.
+ *  The clock pin is set high for a step, and sm_driver_Flush() ends the
+ *  pulse, or toggled in dual edge mode. Otherwise only axis 0 is
+ *  connected, through the steptab.
+ *  Only the shadow register is changed, an axis can step once per
+ *  sm_driver_Flush().
+ *
+ *  \param axis  Axis to move, 0 to MAX_AXES-1.
+ *  \param inc  Direction to move.
+ */
+void sm_driver_AxisStep(unsigned char axis, signed char inc)
+{
+#ifdef STEP_CLOCK_MODE
+  if(inc == CCW){
+    smPortShadow |= (1<<(DIR_PIN+axis));
+  }
+  else{
+    smPortShadow &= ~(1<<(DIR_PIN+axis));
+  }
+  if(stepDualEdge){
+    smPortShadow ^= (1<<(CLOCK_PIN+axis));
+  }
+  else{
+    smPortShadow |= (1<<(CLOCK_PIN+axis));
+  }
+#else
+  if(axis == 0){
+    sm_driver_StepCounter(inc);
+  }
+#endif
+}
+
 /*! \brief Convert the stepcounter value to signals for the stepper motor.
  *
  *  Uses the stepcounter value as index in steptab to get correct
@@ -126,30 +187,99 @@ void sm_driver_StepOutput(unsigned char pos)
   /*
   // Output bit by bit
   if(temp&(1<<BIT_A1))
-    SM_PORT |= (1<<A1);
+    smPortShadow |= (1<<A1);
   else
-    SM_PORT &= ~(1<<A1);
+    smPortShadow &= ~(1<<A1);
 
   if(temp&(1<<BIT_A2))
-    SM_PORT |= (1<<A2);
+    smPortShadow |= (1<<A2);
   else
-    SM_PORT &= ~(1<<A2);
+    smPortShadow &= ~(1<<A2);
 
   if(temp&(1<<BIT_B1))
-    SM_PORT |= (1<<B1);
+    smPortShadow |= (1<<B1);
   else
-    SM_PORT &= ~(1<<B1);
+    smPortShadow &= ~(1<<B1);
 
   if(temp&(1<<BIT_B2))
-    SM_PORT |= (1<<B2);
+    smPortShadow |= (1<<B2);
   else
-    SM_PORT &= ~(1<<B2);
+    smPortShadow &= ~(1<<B2);
   */
 
   // Output the fast way
-  // SM_PORT |= ((temp<<4)&0xF0);
-  // SM_PORT &= ((temp<<4)|0x0F);
+  // smPortShadow |= ((temp<<4)&0xF0);
+  // smPortShadow &= ((temp<<4)|0x0F);
+
+  smPortShadow = temp;
+}
+
+/*! \brief Port value with the steps of this tick, before sm_driver_Flush().
+ */
+unsigned char sm_driver_Port(void)
+{
+  return smPortShadow;
+}
+
+/*! \brief Busy wait, for step pulse timing.
+ *
+ *  Spins through the RT loop timer backend, on the real clock, or moves
+ *  the virtual clock on when the RT loop runs on virtual time.
+ *
+ *  \param ns  Time to wait in [ns].
+ */
+static void sm_driver_Delay(unsigned long ns)
+{
+  struct timespec t;
+
+  if(ns == 0){
+    return;
+  }
+  rt_timer_now(&t);
+  t.tv_sec += ns / 1000000000;
+  t.tv_nsec += ns % 1000000000;
+  if(t.tv_nsec >= 1000000000){
+    t.tv_sec++;
+    t.tv_nsec -= 1000000000;
+  }
+  rt_timer_spin_until(&t);
+}
+
+/*! \brief Write the shadow register to the port.
+ *
+ *  Called once per tick by the RT loop, after all axes have stepped, so
+ *  the port is written once however many axes share it. Nothing is
+ *  written if no bit changed.
+ *  In step clock mode a changed direction pin is written first, \ref
+ *  stepDirSetup before the step edges, and the step pulses are ended
+ *  \ref stepPulseWidth after them, unless in dual edge mode.
+ */
+void sm_driver_Flush(void)
+{
+#ifdef STEP_CLOCK_MODE
+  unsigned char dir;
 
-  SM_PORT = temp;
-  OUTB(SM_PORT);
+  if(smPortShadow == smPortWritten){
+    return;
+  }
+  dir = (smPortShadow ^ smPortWritten) & DIR_MASK;
+  if(dir && ((smPortShadow ^ smPortWritten) & CLOCK_MASK)){
+    smPortWritten ^= dir;
+    OUTB(smPortWritten);
+    sm_driver_Delay(stepDirSetup);
+  }
+  smPortWritten = smPortShadow;
+  OUTB(smPortShadow);
+  if(!stepDualEdge && (smPortShadow & CLOCK_MASK)){
+    sm_driver_Delay(stepPulseWidth);
+    smPortShadow &= ~CLOCK_MASK;
+    smPortWritten = smPortShadow;
+    OUTB(smPortShadow);
+  }
+#else
+  if(smPortShadow != smPortWritten){
+    smPortWritten = smPortShadow;
+    OUTB(smPortShadow);
+  }
+#endif /* STEP_CLOCK_MODE */
 }
@@ -24,8 +24,9 @@
 // Parallel Port
 #define BASE 0x378
 
+// Port writes go through the output backend selected in output.c
 #if (1)
-#define OUTB(a)	do { outb((a), BASE); } while (0)
+#define OUTB(a)	do { output_write(a); } while (0)
 #else
 #define OUTB(a)
 #endif
@@ -53,11 +54,39 @@
 #define B1    1 //!< Stepper motor winding B positive pole.
 #define B2    0 //!< Stepper motor winding B negative pole.
 
+/*! \Brief Number of stepper motors on the port.
+ *
+ * In step clock mode axis n is clocked on pin CLOCK_PIN+n, with its
+ * direction on pin DIR_PIN+n.
+ */
+#define MAX_AXES 4
+
+/*! \Brief Step pulse timing defaults, in [ns].
+ *
+ * Width of the step pulse and setup time from a direction change to the
+ * step edge, long enough for common step/dir drivers.
+ */
+#define STEP_PULSE_NS     2000
+#define STEP_DIR_SETUP_NS 1000
+
 void sm_driver_Init_IO(void);
 unsigned char sm_driver_StepCounter(signed char inc);
 void sm_driver_StepOutput(unsigned char pos);
+void sm_driver_AxisStep(unsigned char axis, signed char inc);
+void sm_driver_Flush(void);
+unsigned char sm_driver_Port(void);
 
 //! Position of stepper motor.
 extern int stepPosition;
+//! Axis moved by sm_driver_StepCounter().
+extern unsigned char stepAxis;
+//! TRUE when using halfsteps, set by speed_cntr_Config().
+extern unsigned char stepHalfsteps;
+//! Step pulse width in [ns], step clock mode.
+extern unsigned long stepPulseWidth;
+//! Direction to step edge setup time in [ns], step clock mode.
+extern unsigned long stepDirSetup;
+//! TRUE to step on both edges of the clock pin, no pulse.
+extern unsigned char stepDualEdge;
 
 #endif
@@ -22,16 +22,38 @@
  *****************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include "global.h"
 #include "sm_driver.h"
 #include "speed_cntr.h"
 #include "stdbool.h"
 
-//! Cointains data for timer interrupt.
-speedRampData srd;
-unsigned int OCR1A;	/* Output Compare Register */
-unsigned int TCCR1B;	/* Timer Counter Control Register */
-unsigned int TIMSK1;	/* Output Compare A Match Interrupt enable */
+//! Default controller, the plain speed_cntr_ functions, srd, srt and the
+//! timer registers are this one.
+speedCntr sc = {
+  .table = {FALSE, FALSE, 0, 0, sc.ramp_accel[0], sc.ramp_decel[0]},
+  .next_table = {FALSE, FALSE, 0, 0, sc.ramp_accel[1], sc.ramp_decel[1]},
+};
+
+//! Common configurations, with the maths constants folded at compile time.
+static const speedCntrParams presets[] = {
+  SPEED_CNTR_PARAMS(T1_FREQ, FSPR, SPR_HALFSTEPS),
+  SPEED_CNTR_PARAMS(4607, 200, 0),
+  SPEED_CNTR_PARAMS(4607, 200, 1),
+  SPEED_CNTR_PARAMS(4607, 400, 0),
+  SPEED_CNTR_PARAMS(4607, 400, 1),
+  SPEED_CNTR_PARAMS(460750, 200, 0),
+  SPEED_CNTR_PARAMS(460750, 200, 1),
+  SPEED_CNTR_PARAMS(460750, 400, 0),
+  SPEED_CNTR_PARAMS(460750, 400, 1),
+};
+
+//! Controller parameters in use.
+speedCntrParams scp = SPEED_CNTR_PARAMS(T1_FREQ, FSPR, SPR_HALFSTEPS);
+
+static unsigned char speed_cntr_Compile_Ramp_Of(speedCntr *c);
+static unsigned char speed_cntr_Compile_SCurve_Of(speedCntr *c, unsigned int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk);
 
 /*! \brief Move the stepper motor a given number of steps.
  *
@@ -46,108 +68,798 @@ unsigned int TIMSK1;	/* Output Compare A Match Interrupt enable */
  *  \param decel  Decelration to use, in 0.01*rad/sec^2.
  *  \param speed  Max speed, in 0.01*rad/sec.
  */
-void speed_cntr_Move(signed int step, unsigned int accel, unsigned int decel, unsigned int speed)
+void speed_cntr_Move_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed)
+{
+  speed_cntr_Move_Blend_Of(c, step, accel, decel, speed, 0, 0);
+}
+
+/*! \brief Move the stepper motor a given number of steps, from and to speed.
+ *
+ *  Like speed_cntr_Move(), but the move starts at entry speed and ends at
+ *  exit speed instead of standing still. The ramp is placed as if the
+ *  motor had been accelerated from zero to entry speed with accel, and
+ *  would be decelerated from exit speed to zero with decel.
+ *  With entry speed the timer is kept running, so the move must be set up
+ *  right after the previous one ended (run_state STOP) at that speed.
+ *  The caller (motion_queue.c) must make sure exit speed can be reached.
+ *
+ *  \param step  Number of steps to move (pos - CW, neg - CCW).
+ *  \param accel  Accelration to use, in 0.01*rad/sec^2.
+ *  \param decel  Decelration to use, in 0.01*rad/sec^2.
+ *  \param speed  Max speed, in 0.01*rad/sec.
+ *  \param entry  Speed at start of move, in 0.01*rad/sec.
+ *  \param exit  Speed at end of move, in 0.01*rad/sec.
+ */
+void speed_cntr_Move_Blend_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int entry, unsigned int exit)
+{
+  if(speed_cntr_Plan_Blend_Of(c, step, accel, decel, speed, entry, exit)){
+    speed_cntr_Start_Of(c);
+  }
+}
+
+/*! \brief Plan a move into the next move buffer, without starting it.
+ *
+ *  Same parameters as speed_cntr_Move_Blend(). All the maths of the move
+ *  setup (my_sqrt(), divisions, ramp tables) is done here, into srd_next
+ *  and the spare delay tables, so it can be done while the running move
+ *  is executing. speed_cntr_Start() then swaps it in.
+ *
+ *  \return  FALSE if there is nothing to move.
+ */
+unsigned char speed_cntr_Plan_Blend_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int entry, unsigned int exit)
 {
   //! Number of steps before we hit max speed.
   unsigned int max_s_lim;
   //! Number of steps before we must start deceleration (if accel does not hit max speed).
-  unsigned int accel_lim;
+  signed long accel_lim;
+  //! Number of steps from zero to entry speed, and from exit speed to zero.
+  unsigned int entry_lim, exit_lim;
+
+  // Only move if number of steps to move is not zero.
+  if(step == 0){
+    return FALSE;
+  }
+
+  // Linear ramp, decel from RUN uses the recurrence.
+  c->next_ramp.scurve = FALSE;
+  c->next_ramp.velocity = FALSE;
+  c->next_ramp.slowdown = FALSE;
+  // Kept for speed_cntr_Speed().
+  c->next_ramp.accel = accel;
+  c->next_ramp.decel = decel;
+  c->next_ramp.exit = exit;
 
   // Set direction from sign on step value.
   if(step < 0){
-    srd.dir = CCW;
+    c->next_ramp.dir = CCW;
     step = -step;
   }
   else{
-    srd.dir = CW;
+    c->next_ramp.dir = CW;
   }
 
   // If moving only 1 step.
-  if(step == 1){
+  if(step == 1 && entry == 0){
     // Move one step...
-    srd.accel_count = -1;
+    c->next_ramp.accel_count = -1;
     // ...in DECEL state.
-    srd.run_state = DECEL;
+    c->next_ramp.run_state = DECEL;
+    c->next_ramp.decel_end = 0;
+    // No ramp to precompute.
+    c->next_table.valid = FALSE;
     // Just a short delay so main() can act on 'running'.
-    srd.step_delay = 1000;
-    status.running = TRUE;
-    OCR1A = 10;
-    // Run Timer/Counter 1 with prescaler = 8.
-    TCCR1B |= ((0<<CS12)|(1<<CS11)|(0<<CS10));
+    c->next_ramp.step_delay = 1000;
+    c->next_blend = FALSE;
   }
-  // Only move if number of steps to move is not zero.
-  else if(step != 0){
+  else{
     // Refer to documentation for detailed information about these calculations.
 
     // Set max speed limit, by calc min_delay to use in timer.
     // min_delay = (alpha / tt)/ w
-    srd.min_delay = A_T_x100 / speed;
-
-    // Set accelration by calc the first (c0) step delay .
-    // step_delay = 1/tt * my_sqrt(2*alpha/accel)
-    // step_delay = ( tfreq*0.676/100 )*100 * my_sqrt( (2*alpha*10000000000) / (accel*100) )/10000
-    srd.step_delay = (T1_FREQ_148 * my_sqrt(A_SQ / accel))/100;
+    c->next_ramp.min_delay = scp.a_t_x100 / speed;
 
     // Find out after how many steps does the speed hit the max speed limit.
     // max_s_lim = speed^2 / (2*alpha*accel)
-    max_s_lim = (long)speed*speed/(long)(((long)A_x20000*accel)/100);
+    max_s_lim = (long)speed*speed/(long)(((long)scp.a_x20000*accel)/100);
     // If we hit max speed limit before 0,5 step it will round to 0.
     // But in practice we need to move atleast 1 step to get any speed at all.
     if(max_s_lim == 0){
       max_s_lim = 1;
     }
 
+    // Same for entry and exit speed, the ramp starts/ends this far from zero.
+    entry_lim = (long)entry*entry/(long)(((long)scp.a_x20000*accel)/100);
+    exit_lim = (long)exit*exit/(long)(((long)scp.a_x20000*decel)/100);
+
     // Find out after how many steps we must start deceleration.
     // n1 = (n1+n2)decel / (accel + decel)
-    accel_lim = ((long)step*decel) / (accel+decel);
+    // with the ramps shifted by entry_lim and exit_lim
+    accel_lim = ((long)(step + exit_lim)*decel - (long)entry_lim*accel) / (accel+decel);
     // We must accelrate at least 1 step before we can start deceleration.
-    if(accel_lim == 0){
+    if(accel_lim == 0 && entry == 0){
       accel_lim = 1;
     }
 
     // Use the limit we hit first to calc decel.
-    if(accel_lim <= max_s_lim){
-      srd.decel_val = accel_lim - step;
+    if(accel_lim <= 0){
+      // Too fast already, decelerate from first step.
+      c->next_ramp.decel_val = -step;
+    }
+    else if(accel_lim + entry_lim <= max_s_lim){
+      c->next_ramp.decel_val = accel_lim - step;
     }
     else{
-      srd.decel_val = -(((long)(max_s_lim*accel))/decel);
+      c->next_ramp.decel_val = -(((long)(max_s_lim*accel))/decel) + (signed int)exit_lim;
+      if(c->next_ramp.decel_val < -step){
+        c->next_ramp.decel_val = -step;
+      }
     }
     // We must decelrate at least 1 step to stop.
-    if(srd.decel_val == 0){
-      srd.decel_val = -1;
+    if(c->next_ramp.decel_val >= 0){
+      c->next_ramp.decel_val = -1;
     }
 
     // Find step to start decleration.
-    srd.decel_start = step + srd.decel_val;
+    c->next_ramp.decel_start = step + c->next_ramp.decel_val;
+    // Decel ends at exit speed.
+    c->next_ramp.decel_val -= (signed int)exit_lim;
+    c->next_ramp.decel_end = -(signed int)exit_lim;
 
-    // If the maximum speed is so low that we dont need to go via accelration state.
-    if(srd.step_delay <= srd.min_delay){
-      srd.step_delay = srd.min_delay;
-      srd.run_state = RUN;
+    if(entry == 0){
+      // Set accelration by calc the first (c0) step delay .
+      // step_delay = 1/tt * my_sqrt(2*alpha/accel)
+      // step_delay = ( tfreq*0.676/100 )*100 * my_sqrt( (2*alpha*10000000000) / (accel*100) )/10000
+      // step_delay = ( tfreq*676 ) * my_sqrt( (2*alpha*10000000000) / (accel*100) )/10000000
+      c->next_ramp.step_delay = (scp.t1_freq_676 * my_sqrt(scp.a_sq / accel))/10000000;
+
+      // If the maximum speed is so low that we dont need to go via accelration state.
+      if(c->next_ramp.step_delay <= c->next_ramp.min_delay){
+        c->next_ramp.step_delay = c->next_ramp.min_delay;
+        c->next_ramp.run_state = RUN;
+      }
+      else{
+        c->next_ramp.run_state = ACCEL;
+      }
+
+      // Reset counter.
+      c->next_ramp.accel_count = 0;
+      c->next_blend = FALSE;
     }
     else{
-      srd.run_state = ACCEL;
+      // Continue at entry speed, timer is already running.
+      c->next_blend = TRUE;
+      c->next_ramp.step_delay = scp.a_t_x100 / entry;
+      if(c->next_ramp.decel_start == 0){
+        c->next_ramp.accel_count = c->next_ramp.decel_val;
+        c->next_ramp.run_state = DECEL;
+      }
+      else{
+        // An accel step at max speed goes on to RUN.
+        c->next_ramp.accel_count = entry_lim;
+        c->next_ramp.run_state = ACCEL;
+      }
     }
 
-    // Reset counter.
-    srd.accel_count = 0;
-    status.running = TRUE;
-    OCR1A = 10;
+    // Precompute the step delays for the whole ramp.
+    c->next_table.valid = c->table.enabled && speed_cntr_Compile_Ramp_Of(c);
 
-#if (1)
+#ifdef SRD_DUMP
     // dump speedRampData;
-    printf("srd.run_state = %d\n", srd.run_state);
-    printf("srd.dir = %d\n", srd.dir);
-    printf("srd.step_delay = %d\n", srd.step_delay);
-    printf("srd.decel_start = %d\n", srd.decel_start);
-    printf("srd.decel_val = %d\n", srd.decel_val);
-    printf("srd.min_delay = %d\n", srd.min_delay);
-    printf("srd.accel_count = %d\n", srd.accel_count);
+    printf("srd.run_state = %d\n", c->next_ramp.run_state);
+    printf("srd.dir = %d\n", c->next_ramp.dir);
+    printf("srd.step_delay = %u\n", c->next_ramp.step_delay);
+    printf("srd.decel_start = %u\n", c->next_ramp.decel_start);
+    printf("srd.decel_val = %d\n", c->next_ramp.decel_val);
+    printf("srd.decel_end = %d\n", c->next_ramp.decel_end);
+    printf("srd.min_delay = %u\n", c->next_ramp.min_delay);
+    printf("srd.accel_count = %d\n", c->next_ramp.accel_count);
+    if(c->next_table.valid){
+      printf("srt.accel_len = %d\n", c->next_table.accel_len);
+      printf("srt.decel_len = %d\n", c->next_table.decel_len);
+    }
+#endif
+  }
+  c->next_ready = TRUE;
+  return TRUE;
+}
+
+/*! \brief Move the stepper motor a given number of steps, jerk limited.
+ *
+ *  Like speed_cntr_Move(), but the acceleration is ramped up and down with
+ *  the given jerk (S-curve), instead of switching on and off at the start
+ *  and end of the accel and decel parts. The whole accel and decel parts
+ *  are compiled into srt here, the timer interrupt only indexes them in
+ *  run states SACCEL and SDECEL. Max speed is lowered if the move is too
+ *  short to reach it, or the ramps would not fit in the tables.
+ *  Jerk 0 gives the linear ramp of speed_cntr_Move().
+ *
+ *  \param step  Number of steps to move (pos - CW, neg - CCW).
+ *  \param accel  Max accelration to use, in 0.01*rad/sec^2.
+ *  \param decel  Max decelration to use, in 0.01*rad/sec^2.
+ *  \param speed  Max speed, in 0.01*rad/sec.
+ *  \param jerk  Jerk to use, in 0.01*rad/sec^3.
+ */
+void speed_cntr_Move_SCurve_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk)
+{
+  if(speed_cntr_Plan_SCurve_Of(c, step, accel, decel, speed, jerk)){
+    speed_cntr_Start_Of(c);
+  }
+}
+
+/*! \brief Plan a jerk limited move into the next move buffer.
+ *
+ *  Same parameters as speed_cntr_Move_SCurve(), see speed_cntr_Plan_Blend().
+ *
+ *  \return  FALSE if there is nothing to move.
+ */
+unsigned char speed_cntr_Plan_SCurve_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk)
+{
+  // One step has no ramp, and jerk 0 is the linear ramp.
+  if(jerk == 0 || step == 1 || step == -1){
+    return speed_cntr_Plan_Blend_Of(c, step, accel, decel, speed, 0, 0);
+  }
+  if(step == 0){
+    return FALSE;
+  }
+
+  // Set direction from sign on step value.
+  if(step < 0){
+    c->next_ramp.dir = CCW;
+    step = -step;
+  }
+  else{
+    c->next_ramp.dir = CW;
+  }
+
+  // Not used by the linear ramp tables.
+  c->next_table.valid = FALSE;
+  c->next_ramp.scurve = TRUE;
+  c->next_ramp.velocity = FALSE;
+  c->next_ramp.slowdown = FALSE;
+  if(!speed_cntr_Compile_SCurve_Of(c, step, accel, decel, speed, jerk)){
+    // Parameters out of range, fall back to the linear ramp.
+    return speed_cntr_Plan_Blend_Of(c, c->next_ramp.dir == CCW ? -step : step, accel, decel, speed, 0, 0);
+  }
+
+  // Decel ends after the last step.
+  c->next_ramp.decel_end = step;
+  c->next_ramp.accel_count = 0;
+  c->next_ramp.run_state = SACCEL;
+  c->next_blend = FALSE;
+
+#ifdef SRD_DUMP
+  // dump speedRampData;
+  printf("srd.run_state = %d\n", c->next_ramp.run_state);
+  printf("srd.dir = %d\n", c->next_ramp.dir);
+  printf("srd.step_delay = %u\n", c->next_ramp.step_delay);
+  printf("srd.decel_start = %u\n", c->next_ramp.decel_start);
+  printf("srd.decel_end = %d\n", c->next_ramp.decel_end);
+  printf("srd.min_delay = %u\n", c->next_ramp.min_delay);
+  printf("srt.accel_len = %d\n", c->next_table.accel_len);
+  printf("srt.decel_len = %d\n", c->next_table.decel_len);
 #endif
 
-    // Set Timer/Counter to divide clock by 8
-    TCCR1B |= ((0<<CS12)|(1<<CS11)|(0<<CS10));
+  c->next_ready = TRUE;
+  return TRUE;
+}
+
+/*! \brief TRUE when a planned move waits for speed_cntr_Start().
+ */
+unsigned char speed_cntr_Ready_Of(speedCntr *c)
+{
+  return c->next_ready;
+}
+
+/*! \brief Start the move planned by speed_cntr_Plan_Blend() or _SCurve().
+ *
+ *  Swaps the planned move in, no maths left, so a queued move starts right
+ *  at the STOP of the previous one. Must be called when no move is running,
+ *  or right after the running move reached run_state STOP, before its STOP
+ *  interrupt.
+ */
+void speed_cntr_Start_Of(speedCntr *c)
+{
+  uint32_t *accel, *decel;
+
+  if(!c->next_ready){
+    return;
+  }
+  c->next_ready = FALSE;
+
+  c->ramp = c->next_ramp;
+  // Swap delay tables, the old ones are planned into next.
+  accel = c->table.accel;
+  decel = c->table.decel;
+  c->table.valid = c->next_table.valid;
+  c->table.accel_len = c->next_table.accel_len;
+  c->table.decel_len = c->next_table.decel_len;
+  c->table.accel = c->next_table.accel;
+  c->table.decel = c->next_table.decel;
+  c->next_table.accel = accel;
+  c->next_table.decel = decel;
+
+  if(!c->next_blend){
+    c->running = TRUE;
+    c->ocr1a = 10;
+  }
+  // Set Timer/Counter to divide clock by 8
+  c->tccr1b |= ((0<<CS12)|(1<<CS11)|(0<<CS10));
+}
+
+/*! \brief Stop the running move at once, without decel.
+ *
+ *  The STOP interrupt follows on the next timer tick and stops the timer.
+ */
+void speed_cntr_Stop_Of(speedCntr *c)
+{
+  if(c->ramp.run_state != STOP){
+    c->ramp.run_state = STOP;
+    c->ramp.step_delay = 1;
+    c->ocr1a = 1;
+  }
+}
+
+/*! \brief Number of steps from zero to speed with given accel/decel.
+ *
+ *  This is where accel_count starts to ramp on from speed.
+ *  n = speed^2 / (2*alpha*accel)
+ */
+static uint32_t speed_cntr_Lim(unsigned int speed, unsigned int accel)
+{
+  return (uint64_t)speed*speed/(((uint64_t)scp.a_x20000*accel)/100);
+}
+
+/*! \brief Run the stepper motor without end, at given speed.
+ *
+ *  Velocity mode, the motor accelerates to speed and runs until
+ *  speed_cntr_Speed() changes it. Speed 0 decelerates to stop.
+ *  A running linear move is switched to velocity mode at its current speed.
+ *
+ *  \param dir  Direction to run when standing still, CW or CCW.
+ *  \param accel  Accelration to use, in 0.01*rad/sec^2.
+ *  \param decel  Decelration to use, in 0.01*rad/sec^2.
+ *  \param speed  Speed, in 0.01*rad/sec.
+ *  \return  FALSE if running an S-curve move.
+ */
+unsigned char speed_cntr_Velocity_Of(speedCntr *c, unsigned char dir, unsigned int accel, unsigned int decel, unsigned int speed)
+{
+  if(c->ramp.run_state != STOP || c->running){
+    if(c->ramp.scurve){
+      return FALSE;
+    }
+    // No planned end any more.
+    c->ramp.accel = accel;
+    c->ramp.decel = decel;
+    c->ramp.velocity = TRUE;
+    c->ramp.decel_start = UINT32_MAX;
+    return speed_cntr_Speed_Of(c, speed);
+  }
+  if(speed == 0){
+    return TRUE;
+  }
+
+  c->ramp.dir = dir;
+  c->ramp.accel = accel;
+  c->ramp.decel = decel;
+  c->ramp.exit = 0;
+  c->ramp.scurve = FALSE;
+  c->ramp.velocity = TRUE;
+  c->ramp.slowdown = FALSE;
+  c->table.valid = FALSE;
+  c->ramp.decel_start = UINT32_MAX;
+  c->ramp.decel_val = 0;
+  c->ramp.decel_end = 0;
+  c->ramp.min_delay = scp.a_t_x100 / speed;
+  // First step delay (c0), as in speed_cntr_Move_Blend().
+  c->ramp.step_delay = (scp.t1_freq_676 * my_sqrt(scp.a_sq / accel))/10000000;
+  if(c->ramp.step_delay <= c->ramp.min_delay){
+    c->ramp.step_delay = c->ramp.min_delay;
+    c->ramp.run_state = RUN;
+  }
+  else{
+    c->ramp.run_state = ACCEL;
+  }
+  c->ramp.accel_count = 0;
+  c->running = TRUE;
+  c->ocr1a = 10;
+  // Set Timer/Counter to divide clock by 8
+  c->tccr1b |= ((0<<CS12)|(1<<CS11)|(0<<CS10));
+  return TRUE;
+}
+
+/*! \brief Change the speed of the running move.
+ *
+ *  The ramp is re-entered from the current step_delay: ACCEL from the
+ *  accel_count that matches the current speed if speed is raised, DECEL
+ *  down to the new speed and RUN on if lowered. A move of a given number
+ *  of steps is re-planned over the steps left, so it still ends at its
+ *  exit speed; it can not be sped up once decel has started. Speed 0
+ *  decelerates to stop at once, short of the end of the move.
+ *  The rest of the move runs on-line, the ramp tables hold the old plan.
+ *
+ *  \param speed  New max speed, in 0.01*rad/sec.
+ *  \return  FALSE if the speed could not be changed.
+ */
+unsigned char speed_cntr_Speed_Of(speedCntr *c, unsigned int speed)
+{
+  //! Speed now, from the next step delay.
+  unsigned int now;
+  //! Steps left of the move.
+  int32_t left;
+  //! Steps to decelerate from now, and from the new speed.
+  int32_t now_lim, new_lim;
+
+  if(c->ramp.run_state == STOP || c->ramp.scurve){
+    return FALSE;
+  }
+  now = scp.a_t_x100 / c->ramp.step_delay;
+  now_lim = speed_cntr_Lim(now, c->ramp.decel);
+  new_lim = speed_cntr_Lim(speed, c->ramp.decel);
+
+  if(c->ramp.velocity){
+    left = INT32_MAX;
+  }
+  else if(c->ramp.run_state == DECEL && !c->ramp.slowdown){
+    // Already stopping at the end of the move.
+    if(speed != 0){
+      return FALSE;
+    }
+    left = c->ramp.decel_end - c->ramp.accel_count;
+  }
+  else{
+    left = c->ramp.decel_start - c->step_count + (c->ramp.decel_end - c->ramp.decel_val);
+  }
+
+  // Decelerate to stop now.
+  if(speed == 0){
+    c->ramp.accel_count = -now_lim;
+    c->ramp.decel_val = -now_lim;
+    c->ramp.decel_end = 0;
+    c->ramp.slowdown = FALSE;
+    c->ramp.run_state = DECEL;
+    c->rest = 0;
+    // The decel table is for the end of the planned move.
+    c->table.valid = FALSE;
+    return TRUE;
+  }
+
+  c->table.valid = FALSE;
+  if(speed > now){
+    if(c->ramp.velocity){
+      c->ramp.min_delay = scp.a_t_x100 / speed;
+      c->ramp.accel_count = speed_cntr_Lim(now, c->ramp.accel);
+      c->ramp.slowdown = FALSE;
+      c->ramp.run_state = ACCEL;
+      c->rest = 0;
+    }
+    else{
+      // Same as a queued move entering at the current speed.
+      c->step_count = 0;
+      c->rest = 0;
+      speed_cntr_Move_Blend_Of(c, c->ramp.dir == CCW ? -left : left, c->ramp.accel, c->ramp.decel, speed, now, c->ramp.exit);
+    }
+  }
+  else{
+    // Decel down to new speed, then RUN.
+    c->ramp.min_delay = scp.a_t_x100 / speed;
+    c->ramp.accel_count = -now_lim;
+    c->ramp.decel_val = -new_lim;
+    if(!c->ramp.velocity){
+      // Final decel from new speed to exit speed.
+      c->step_count = 0;
+      left -= new_lim + c->ramp.decel_end;
+      c->ramp.decel_start = left > 0 ? left : 0;
+    }
+    c->ramp.slowdown = TRUE;
+    c->ramp.run_state = DECEL;
+    c->rest = 0;
+  }
+  return TRUE;
+}
+
+/*! \brief Precompute the step delays of the move planned in srd_next.
+ *
+ *  Runs the same recurrence as the timer interrupt, off-line, and stores
+ *  every new step_delay of the accel and decel parts in srt_next.
+ *  The run states are still changed by the timer interrupt, only the
+ *  divisions are replaced by table lookups.
+ *
+ *  \return  TRUE if the whole ramp fits in the tables.
+ */
+static unsigned char speed_cntr_Compile_Ramp_Of(speedCntr *c)
+{
+  uint32_t step_delay = c->next_ramp.step_delay;
+  uint32_t new_step_delay = 0;
+  uint32_t step_count = 0;
+  uint32_t rest = 0;
+  int32_t accel_count = c->next_ramp.accel_count;
+
+  c->next_table.accel_len = 0;
+  c->next_table.decel_len = 0;
+
+  // Decel from RUN starts with the last accel delay, which is only known
+  // when the move accelerates.
+  if(c->next_ramp.run_state != ACCEL){
+    return FALSE;
+  }
+
+  // Accel part, until decel starts or max speed is hit.
+  for(;;){
+    if(c->next_table.accel_len >= RAMP_TABLE_SIZE){
+      return FALSE;
+    }
+    step_count++;
+    accel_count++;
+    new_step_delay = step_delay - (((2 * (uint64_t)step_delay) + rest)/(4 * accel_count + 1));
+    rest = ((2 * (uint64_t)step_delay)+rest)%(4 * accel_count + 1);
+    c->next_table.accel[c->next_table.accel_len++] = new_step_delay;
+    if(step_count >= c->next_ramp.decel_start){
+      break;
+    }
+    else if(new_step_delay <= c->next_ramp.min_delay){
+      // Decel will start from RUN with this delay.
+      rest = 0;
+      break;
+    }
+    step_delay = new_step_delay;
+  }
+  step_delay = new_step_delay;
+
+  // Decel part, until stop or exit speed.
+  accel_count = c->next_ramp.decel_val;
+  while(accel_count < c->next_ramp.decel_end){
+    if(c->next_table.decel_len >= RAMP_TABLE_SIZE){
+      return FALSE;
+    }
+    accel_count++;
+    new_step_delay = step_delay + (((2 * (uint64_t)step_delay) + rest)/(4 * abs(accel_count) + 1));
+    rest = ((2 * (uint64_t)step_delay)+rest)%(4 * abs(accel_count) + 1);
+    c->next_table.decel[c->next_table.decel_len++] = new_step_delay;
+    step_delay = new_step_delay;
+  }
+
+  return TRUE;
+}
+
+/*! \brief Jerk limited ramp from standing still to a given speed.
+ *
+ *  Jerk phase up to max accel (or less, if speed is reached before),
+ *  constant accel phase, and jerk phase down to zero accel at speed.
+ *  Units are steps and seconds.
+ */
+typedef struct {
+  //! Jerk, max accel and end speed.
+  double j, a, v;
+  //! Time of each jerk phase, and of the constant accel phase.
+  double tj, ta;
+  //! Position and speed at the end of the first jerk phase.
+  double x1, v1;
+  //! Position and speed at the end of the constant accel phase.
+  double x2, v2;
+  //! Length and duration of the whole ramp.
+  double len, time;
+} sCurveRamp;
+
+/*! \brief Set up a jerk limited ramp from zero to speed v.
+ */
+static void speed_cntr_SCurve_Ramp(sCurveRamp *r, double j, double a, double v)
+{
+  r->j = j;
+  r->v = v;
+  if(v*j >= a*a){
+    // Max accel is reached.
+    r->tj = a/j;
+    r->ta = v/a - a/j;
+  }
+  else{
+    // Speed is reached before max accel.
+    r->tj = sqrt(v/j);
+    r->ta = 0;
+  }
+  r->a = j*r->tj;
+  r->x1 = j*r->tj*r->tj*r->tj/6;
+  r->v1 = j*r->tj*r->tj/2;
+  r->x2 = r->x1 + r->v1*r->ta + r->a*r->ta*r->ta/2;
+  r->v2 = r->v1 + r->a*r->ta;
+  r->time = 2*r->tj + r->ta;
+  // Symmetric speed curve, mean speed is v/2.
+  r->len = v*r->time/2;
+}
+
+/*! \brief Time at which the ramp has moved x steps.
+ */
+static double speed_cntr_SCurve_Time(const sCurveRamp *r, double x)
+{
+  double t, d, f;
+  int i;
+
+  if(x <= 0){
+    return 0;
+  }
+  if(x <= r->x1){
+    // x = j*t^3/6
+    return cbrt(6*x/r->j);
+  }
+  if(x <= r->x2){
+    // x = x1 + v1*t + a*t^2/2
+    return r->tj + (sqrt(r->v1*r->v1 + 2*r->a*(x - r->x1)) - r->v1)/r->a;
+  }
+  if(x >= r->len){
+    return r->time;
+  }
+  // Last jerk phase, mirror of the first one seen from the end:
+  // len - x = v*t - j*t^3/6, t counted back from the end.
+  d = r->len - x;
+  t = d/r->v;
+  for(i = 0; i < 20; i++){
+    f = r->v*t - r->j*t*t*t/6 - d;
+    t -= f/(r->v - r->j*t*t/2);
+    if(t > r->tj){
+      t = r->tj;
+    }
+  }
+  return r->time - t;
+}
+
+/*! \brief Compile a jerk limited move into srd_next and srt_next.
+ *
+ *  The move is step-1 steps long between the first and the last step,
+ *  accel ramp, run at max speed, and decel ramp as a mirrored accel ramp.
+ *  Max speed is found by bisection so the ramps fit the move and the tables.
+ *  The delay after step n (1..step-1) is the time from step n+1 to step n+2,
+ *  as the timer interrupt sets the delay one step ahead.
+ *
+ *  \return  FALSE if the parameters are out of range.
+ */
+static unsigned char speed_cntr_Compile_SCurve_Of(speedCntr *c, unsigned int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk)
+{
+  sCurveRamp ra, rd;
+  // 0.01*rad to steps.
+  double k = scp.spr/(200*3.14159);
+  double len = step - 1;
+  double v, lo, hi, run_end, t, last, d;
+  unsigned int n, accel_len, decel_start;
+
+  if(accel == 0 || decel == 0 || speed == 0){
+    return FALSE;
+  }
+
+  // Highest speed with both ramps within the move and the tables.
+  lo = 0;
+  hi = speed*k;
+  for(n = 0; n < 64; n++){
+    v = (n == 0) ? hi : (lo + hi)/2;
+    speed_cntr_SCurve_Ramp(&ra, jerk*k, accel*k, v);
+    speed_cntr_SCurve_Ramp(&rd, jerk*k, decel*k, v);
+    if(ra.len + rd.len <= len && ra.len < RAMP_TABLE_SIZE - 1 && rd.len < RAMP_TABLE_SIZE - 1){
+      if(n == 0){
+        break;
+      }
+      lo = v;
+    }
+    else{
+      hi = v;
+    }
+  }
+  if(n != 0){
+    v = lo;
+    speed_cntr_SCurve_Ramp(&ra, jerk*k, accel*k, v);
+    speed_cntr_SCurve_Ramp(&rd, jerk*k, decel*k, v);
+  }
+  if(v <= 0){
+    return FALSE;
+  }
+  // Delays must fit 32 bit.
+  if(speed_cntr_SCurve_Time(&ra, 1)*scp.t1_freq > 0xffffffffL ||
+     speed_cntr_SCurve_Time(&rd, 1)*scp.t1_freq > 0xffffffffL){
+    return FALSE;
+  }
+
+  // Steps with position (step n at n-1) inside the accel ramp,
+  // and last step before the decel ramp.
+  accel_len = (unsigned int)ra.len + 1;
+  decel_start = (unsigned int)ceil(len - rd.len);
+  if(decel_start < 1){
+    decel_start = 1;
+  }
+  if(accel_len > decel_start){
+    accel_len = decel_start;
+  }
+  c->next_ramp.min_delay = (uint32_t)(scp.t1_freq/v + 0.5);
+  c->next_ramp.decel_start = decel_start;
+  c->next_table.accel_len = accel_len;
+  c->next_table.decel_len = step - decel_start;
+  run_end = ra.time + (len - ra.len - rd.len)/v;
+
+  // Step n is at time t(n-1), delay after step n is t(n+1) - t(n).
+  last = 0;
+  for(n = 0; n <= step - 1; n++){
+    if(n <= ra.len){
+      t = speed_cntr_SCurve_Time(&ra, n);
+    }
+    else if(n < len - rd.len){
+      t = ra.time + (n - ra.len)/v;
+    }
+    else{
+      t = run_end + rd.time - speed_cntr_SCurve_Time(&rd, len - n);
+    }
+    if(n > 0){
+      d = (t - last)*scp.t1_freq + 0.5;
+      if(d < 1){
+        d = 1;
+      }
+      // Delay from step n to step n+1.
+      if(n == 1){
+        c->next_ramp.step_delay = (uint32_t)d;
+      }
+      else if(n - 1 <= accel_len){
+        c->next_table.accel[n - 2] = (uint32_t)d;
+      }
+      if(n - 1 >= decel_start){
+        c->next_table.decel[n - 1 - decel_start] = (uint32_t)d;
+      }
+    }
+    last = t;
+  }
+  // No delay after the last step, STOP comes after the last decel delay.
+  c->next_table.decel[c->next_table.decel_len - 1] = c->next_table.decel_len > 1 ? c->next_table.decel[c->next_table.decel_len - 2] : c->next_ramp.step_delay;
+  if(accel_len == step - 1){
+    c->next_table.accel[accel_len - 1] = c->next_table.decel[c->next_table.decel_len - 1];
+  }
+
+  return TRUE;
+}
+
+/*! \brief Set timer frequency, motor steps per round and step mode.
+ *
+ *  Common configurations are taken from a table of constant folded
+ *  parameters, others are computed with the same expressions. The
+ *  parameters are checked against the ranges the ramp maths can handle,
+ *  and the RT loop period is derived from the timer frequency.
+ *  Must be called before speed_cntr_Move().
+ *
+ *  \param t1_freq  Frequency of timer1 in [Hz].
+ *  \param fspr  Number of (full)steps per round on stepper motor.
+ *  \param halfsteps  TRUE to use halfsteps.
+ *  \return  FALSE if the configuration is not valid, scp is unchanged.
+ */
+unsigned char speed_cntr_Config(uint32_t t1_freq, uint32_t fspr, uint8_t halfsteps)
+{
+  speedCntrParams p;
+  unsigned char i;
+
+  // Timer must be fast enough for the loop and slow enough for 32 bit
+  // delays at the lowest accel. Checked before the maths divide by it.
+  if(t1_freq < 1000 || t1_freq > 100000000){
+    return FALSE;
   }
+  // Steps per round must give a finite alpha, the exact limit follows.
+  if(fspr == 0 || fspr > 0xffff){
+    return FALSE;
+  }
+
+  for(i = 0; i < sizeof(presets)/sizeof(presets[0]); i++){
+    if(presets[i].t1_freq == t1_freq && presets[i].fspr == fspr &&
+       presets[i].halfsteps == (halfsteps ? 1 : 0)){
+      scp = presets[i];
+      stepHalfsteps = scp.halfsteps;
+      return TRUE;
+    }
+  }
+
+  p = (speedCntrParams)SPEED_CNTR_PARAMS(t1_freq, fspr, halfsteps ? 1 : 0);
+  // my_sqrt(A_SQ / accel) only handles 32 bit, and speed needs alpha*20000 >= 1.
+  if(p.a_sq > 0xffffffffL || p.a_x20000 < 1){
+    return FALSE;
+  }
+  // First step delay at accel 1 must fit 32 bit.
+  if((p.t1_freq_676 * my_sqrt(p.a_sq))/10000000 > 0xffffffffL){
+    return FALSE;
+  }
+
+  scp = p;
+  stepHalfsteps = scp.halfsteps;
+  return TRUE;
 }
 
 /*! \brief Init of Timer/Counter1.
@@ -155,17 +867,17 @@ void speed_cntr_Move(signed int step, unsigned int accel, unsigned int decel, un
  *  Set up Timer/Counter1 to use mode 1 CTC and
  *  enable Output Compare A Match Interrupt.
  */
-void speed_cntr_Init_Timer1(void)
+void speed_cntr_Init_Timer1_Of(speedCntr *c)
 {
   // Tells what part of speed ramp we are in.
-  srd.run_state = STOP;
+  c->ramp.run_state = STOP;
   // Timer/Counter 1 in mode 4 CTC (Not running).
-  TCCR1B = (1<<WGM12);
+  c->tccr1b = (1<<WGM12);
   // Timer/Counter 1 Output Compare A Match Interrupt enable.
-  TIMSK1 = (1<<OCIE1A);
+  c->timsk1 = (1<<OCIE1A);
 }
 
-/*! \brief Timer/Counter1 Output Compare A Match Interrupt.
+/*! \brief Timer/Counter1 Output Compare A Match Interrupt of a controller.
  *
  *  Timer/Counter1 Output Compare A Match Interrupt.
  *  Increments/decrements the position of the stepper motor
@@ -174,84 +886,234 @@ void speed_cntr_Init_Timer1(void)
  *  and controls the speed of the stepper motor.
  *  A new step delay is calculated to follow wanted speed profile
  *  on basis of accel/decel parameters.
+ *  Only the controller is touched, the caller outputs the step, so
+ *  controllers can run on different threads.
+ *
+ *  \return  Direction when it stepped, NOACT otherwise.
  */
-/* #pragma vector=TIMER1_COMPA_vect */
-/* __interrupt */int speed_cntr_TIMER1_COMPA_interrupt( void )
-{
-  // Holds next delay period.
-  unsigned int new_step_delay, a, b;
-  // Remember the last step delay used when accelrating.
-  static int last_accel_delay;
-  // Counting steps when moving.
-  static unsigned int step_count = 0;
-  // Keep track of remainder from new_step-delay calculation to incrase accurancy
-  static unsigned int rest = 0;
+int speed_cntr_Step(speedCntr *c)
+{
+  // Holds next delay period, unchanged when stopped.
+  uint32_t new_step_delay = c->ramp.step_delay;
   // return code
   int rc = NOACT;
-  OCR1A = srd.step_delay;
+  c->ocr1a = c->ramp.step_delay;
 
-  switch(srd.run_state) {
+  switch(c->ramp.run_state) {
     case STOP:
-      step_count = 0;
-      rest = 0;
+      c->step_count = 0;
+      c->rest = 0;
       // Stop Timer/Counter 1.
-      TCCR1B &= ~((1<<CS12)|(1<<CS11)|(1<<CS10));
-      status.running = FALSE;
+      c->tccr1b &= ~((1<<CS12)|(1<<CS11)|(1<<CS10));
+      c->running = FALSE;
       break;
 
     case ACCEL:
-      rc = srd.dir;
-      sm_driver_StepCounter(srd.dir);
-      step_count++;
-      srd.accel_count++;
-      new_step_delay = srd.step_delay - (((2 * (long)srd.step_delay) + rest)/(4 * srd.accel_count + 1));
-      rest = ((2 * (long)srd.step_delay)+rest)%(4 * srd.accel_count + 1);
+      rc = c->ramp.dir;
+      c->step_count++;
+      c->ramp.accel_count++;
+      if(c->table.valid){
+        new_step_delay = c->table.accel[c->step_count - 1];
+      }
+      else{
+        new_step_delay = c->ramp.step_delay - (((2 * (uint64_t)c->ramp.step_delay) + c->rest)/(4 * c->ramp.accel_count + 1));
+        c->rest = ((2 * (uint64_t)c->ramp.step_delay)+c->rest)%(4 * c->ramp.accel_count + 1);
+      }
       // Chech if we should start decelration.
-      if(step_count >= srd.decel_start) {
-        srd.accel_count = srd.decel_val;
-        srd.run_state = DECEL;
+      if(c->step_count >= c->ramp.decel_start) {
+        c->ramp.accel_count = c->ramp.decel_val;
+        c->ramp.run_state = DECEL;
       }
       // Chech if we hitted max speed.
-      else if(new_step_delay <= srd.min_delay) {
-        last_accel_delay = new_step_delay;
-        new_step_delay = srd.min_delay;
-        rest = 0;
-        srd.run_state = RUN;
+      else if(new_step_delay <= c->ramp.min_delay) {
+        c->last_accel_delay = new_step_delay;
+        new_step_delay = c->ramp.min_delay;
+        c->rest = 0;
+        c->ramp.run_state = RUN;
       }
       break;
 
     case RUN:
-      rc = srd.dir;
-      sm_driver_StepCounter(srd.dir); 
-      step_count++;
-      new_step_delay = srd.min_delay;
+      rc = c->ramp.dir;
+      c->step_count++;
+      new_step_delay = c->ramp.min_delay;
       // Chech if we should start decelration.
-      if(step_count >= srd.decel_start) {
-        srd.accel_count = srd.decel_val;
-        // Start decelration with same delay as accel ended with.
-        new_step_delay = last_accel_delay;
-        srd.run_state = DECEL;
+      if(c->step_count >= c->ramp.decel_start) {
+        if(c->ramp.scurve){
+          new_step_delay = c->table.decel[0];
+          c->ramp.run_state = SDECEL;
+        }
+        else{
+          c->ramp.accel_count = c->ramp.decel_val;
+          // Start decelration with same delay as accel ended with.
+          new_step_delay = c->last_accel_delay;
+          c->ramp.run_state = DECEL;
+        }
+      }
+      break;
+
+    case SACCEL:
+      rc = c->ramp.dir;
+      c->step_count++;
+      new_step_delay = c->table.accel[c->step_count - 1];
+      // Chech if we should start decelration.
+      if(c->step_count >= c->ramp.decel_start){
+        c->ramp.run_state = SDECEL;
+      }
+      // Chech if accel ramp is done.
+      else if(c->step_count >= c->table.accel_len){
+        c->ramp.run_state = RUN;
+      }
+      break;
+
+    case SDECEL:
+      rc = c->ramp.dir;
+      c->step_count++;
+      // Check if we at last step
+      if(c->step_count >= (uint32_t)c->ramp.decel_end){
+        new_step_delay = c->ramp.step_delay;
+        c->ramp.run_state = STOP;
+        c->step_count = 0;
+        c->rest = 0;
+      }
+      else{
+        new_step_delay = c->table.decel[c->step_count - c->ramp.decel_start];
       }
       break;
 
     case DECEL: 
-      rc = srd.dir;
-      sm_driver_StepCounter(srd.dir); 
-      step_count++;
-      srd.accel_count++;
-      new_step_delay = srd.step_delay + (((2 * (long)srd.step_delay) + rest)/(4 * abs(srd.accel_count) + 1));
-      rest = ((2 * (long)srd.step_delay)+rest)%(4 * abs(srd.accel_count) + 1);
+      rc = c->ramp.dir;
+      c->step_count++;
+      c->ramp.accel_count++;
+      if(c->table.valid){
+        new_step_delay = c->table.decel[c->ramp.accel_count - c->ramp.decel_val - 1];
+      }
+      else{
+        new_step_delay = c->ramp.step_delay + (((2 * (uint64_t)c->ramp.step_delay) + c->rest)/(4 * abs(c->ramp.accel_count) + 1));
+        c->rest = ((2 * (uint64_t)c->ramp.step_delay)+c->rest)%(4 * abs(c->ramp.accel_count) + 1);
+      }
+      // Check if we slowed down to a new speed set by speed_cntr_Speed().
+      if(c->ramp.slowdown && c->ramp.accel_count >= c->ramp.decel_val){
+        c->ramp.slowdown = FALSE;
+        // Run on, unless it is time for the final decel.
+        if(c->step_count < c->ramp.decel_start){
+          c->last_accel_delay = c->ramp.min_delay;
+          new_step_delay = c->ramp.min_delay;
+          c->ramp.run_state = RUN;
+        }
+      }
       // Check if we at last step
-      if(srd.accel_count >= 0){
-        srd.run_state = STOP;
+      else if(c->ramp.accel_count >= c->ramp.decel_end){
+        c->ramp.run_state = STOP;
+        // Ready for a next move to be set up before the STOP interrupt.
+        c->step_count = 0;
+        c->rest = 0;
       }
       break;
   }
-  srd.step_delay = new_step_delay;
+  c->ramp.step_delay = new_step_delay;
   return rc;
 }
 
-/*! \brief Square root routine.
+/*! \brief Set up a new controller.
+ *
+ *  Clears it, points its delay tables at its own buffers and stops its
+ *  timer. The default controller is set up statically.
+ */
+void speed_cntr_Init_Of(speedCntr *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->table.accel = c->ramp_accel[0];
+  c->table.decel = c->ramp_decel[0];
+  c->next_table.accel = c->ramp_accel[1];
+  c->next_table.decel = c->ramp_decel[1];
+  speed_cntr_Init_Timer1_Of(c);
+}
+
+/* Default controller, status.running follows its running flag. */
+
+void speed_cntr_Move(signed int step, unsigned int accel, unsigned int decel, unsigned int speed)
+{
+  speed_cntr_Move_Of(&sc, step, accel, decel, speed);
+  status.running = sc.running;
+}
+
+void speed_cntr_Move_Blend(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int entry, unsigned int exit)
+{
+  speed_cntr_Move_Blend_Of(&sc, step, accel, decel, speed, entry, exit);
+  status.running = sc.running;
+}
+
+void speed_cntr_Move_SCurve(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk)
+{
+  speed_cntr_Move_SCurve_Of(&sc, step, accel, decel, speed, jerk);
+  status.running = sc.running;
+}
+
+unsigned char speed_cntr_Plan_Blend(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int entry, unsigned int exit)
+{
+  return speed_cntr_Plan_Blend_Of(&sc, step, accel, decel, speed, entry, exit);
+}
+
+unsigned char speed_cntr_Plan_SCurve(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk)
+{
+  return speed_cntr_Plan_SCurve_Of(&sc, step, accel, decel, speed, jerk);
+}
+
+unsigned char speed_cntr_Ready(void)
+{
+  return speed_cntr_Ready_Of(&sc);
+}
+
+void speed_cntr_Start(void)
+{
+  speed_cntr_Start_Of(&sc);
+  status.running = sc.running;
+}
+
+void speed_cntr_Stop(void)
+{
+  speed_cntr_Stop_Of(&sc);
+}
+
+unsigned char speed_cntr_Speed(unsigned int speed)
+{
+  unsigned char ok = speed_cntr_Speed_Of(&sc, speed);
+
+  status.running = sc.running;
+  return ok;
+}
+
+unsigned char speed_cntr_Velocity(unsigned char dir, unsigned int accel, unsigned int decel, unsigned int speed)
+{
+  unsigned char ok = speed_cntr_Velocity_Of(&sc, dir, accel, decel, speed);
+
+  status.running = sc.running;
+  return ok;
+}
+
+void speed_cntr_Init_Timer1(void)
+{
+  speed_cntr_Init_Timer1_Of(&sc);
+}
+
+/*! \brief Timer/Counter1 Output Compare A Match Interrupt.
+ *
+ *  Steps the default controller and outputs the step to the motor.
+ */
+/* #pragma vector=TIMER1_COMPA_vect */
+int speed_cntr_TIMER1_COMPA_interrupt( void )
+{
+  int rc = speed_cntr_Step(&sc);
+
+  if(rc != NOACT){
+    sm_driver_StepCounter(rc);
+  }
+  status.running = sc.running;
+  return rc;
+}
+
+/*! \brief Square root routine, bit by bit.
  *
  * my_sqrt routine 'grupe', from comp.sys.ibm.pc.programmer
  * Subject: Summary: SQRT(int) algorithm (with profiling)
@@ -261,7 +1123,7 @@ void speed_cntr_Init_Timer1(void)
  *  \param x  Value to find square root of.
  *  \return  Square root of x.
  */
-static unsigned long my_sqrt(unsigned long x)
+unsigned long my_sqrt_loop(unsigned long x)
 {
   register unsigned long xr;  // result register
   register unsigned long q2;  // scan-bit register
@@ -292,6 +1154,113 @@ static unsigned long my_sqrt(unsigned long x)
   }
 }
 
+/*! \brief Rounding of my_sqrt(), from floor(sqrt(x)).
+ *
+ *  Same as my_sqrt_loop(), plus one if the remainder is larger than the root.
+ */
+static inline unsigned long my_sqrt_round(uint32_t x, uint32_t s)
+{
+  if(s < x - s*s){
+    return s + 1;
+  }
+  return s;
+}
+
+/*! \brief Integer Newton iteration from above, down to floor(sqrt(x)).
+ *
+ *  \param s  Start value, not below floor(sqrt(x)).
+ */
+static inline uint32_t my_sqrt_newton_from(uint32_t x, uint32_t s)
+{
+  uint32_t t;
+
+  for(;;){
+    t = (s + x/s) >> 1;
+    if(t >= s){
+      return s;
+    }
+    s = t;
+  }
+}
+
+/*! \brief Square root routine, Newton seeded by count leading zeros.
+ *
+ *  Same result as my_sqrt_loop() for 32 bit x. The seed 2^ceil(bits/2)
+ *  is above the root, and converges in about 5 divisions.
+ *
+ *  \param x  Value to find square root of.
+ *  \return  Square root of x.
+ */
+unsigned long my_sqrt_newton(unsigned long x)
+{
+  uint32_t v = x;
+
+  if(v == 0){
+    return 0;
+  }
+  return my_sqrt_round(v, my_sqrt_newton_from(v, 1UL << ((33 - __builtin_clz(v)) >> 1)));
+}
+
+//! ceil(sqrt((i+1)*256)), root of the top 8 bits scaled by 16.
+static const uint16_t sqrt_tab[256] = {
+   16,  23,  28,  32,  36,  40,  43,  46,  48,  51,  54,  56,  58,  60,  62,  64,
+   66,  68,  70,  72,  74,  76,  77,  79,  80,  82,  84,  85,  87,  88,  90,  91,
+   92,  94,  95,  96,  98,  99, 100, 102, 103, 104, 105, 107, 108, 109, 110, 111,
+  112, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126, 127, 128,
+  129, 130, 131, 132, 133, 134, 135, 136, 137, 138, 139, 140, 141, 142, 143, 144,
+  144, 145, 146, 147, 148, 149, 150, 151, 151, 152, 153, 154, 155, 156, 156, 157,
+  158, 159, 160, 160, 161, 162, 163, 164, 164, 165, 166, 167, 168, 168, 169, 170,
+  171, 171, 172, 173, 174, 174, 175, 176, 176, 177, 178, 179, 179, 180, 181, 182,
+  182, 183, 184, 184, 185, 186, 186, 187, 188, 188, 189, 190, 190, 191, 192, 192,
+  193, 194, 194, 195, 196, 196, 197, 198, 198, 199, 200, 200, 201, 202, 202, 203,
+  204, 204, 205, 205, 206, 207, 207, 208, 208, 209, 210, 210, 211, 212, 212, 213,
+  213, 214, 215, 215, 216, 216, 217, 218, 218, 219, 219, 220, 220, 221, 222, 222,
+  223, 223, 224, 224, 225, 226, 226, 227, 227, 228, 228, 229, 230, 230, 231, 231,
+  232, 232, 233, 233, 234, 235, 235, 236, 236, 237, 237, 238, 238, 239, 239, 240,
+  240, 241, 242, 242, 243, 243, 244, 244, 245, 245, 246, 246, 247, 247, 248, 248,
+  249, 249, 250, 250, 251, 251, 252, 252, 253, 253, 254, 254, 255, 255, 256, 256
+};
+
+/*! \brief Square root routine, table seeded Newton.
+ *
+ *  Same result as my_sqrt_loop() for 32 bit x. The top 8 bits, taken at
+ *  an even shift, give an 8 bit seed above the root from sqrt_tab, so
+ *  Newton only needs one or two divisions.
+ *
+ *  \param x  Value to find square root of.
+ *  \return  Square root of x.
+ */
+unsigned long my_sqrt_table(unsigned long x)
+{
+  uint32_t v = x;
+  uint32_t shift, bits;
+
+  if(v == 0){
+    return 0;
+  }
+  bits = 32 - __builtin_clz(v);
+  shift = bits > 8 ? ((bits - 7) & ~1) : 0;
+  return my_sqrt_round(v, my_sqrt_newton_from(v, (((uint32_t)sqrt_tab[v >> shift] << (shift >> 1)) + 15) >> 4));
+}
+
+/*! \brief Square root routine.
+ *
+ *  The variant is chosen at build time with MY_SQRT, see speed_cntr.h.
+ *
+ *  \param x  Value to find square root of.
+ *  \return  Square root of x.
+ */
+unsigned long my_sqrt(unsigned long x)
+{
+#if (MY_SQRT == MY_SQRT_TABLE)
+  return my_sqrt_table(x);
+#elif (MY_SQRT == MY_SQRT_NEWTON)
+  return my_sqrt_newton(x);
+#else
+  return my_sqrt_loop(x);
+#endif
+}
+
 /*! \brief Find minimum value.
  *
  *  Returns the smallest value.
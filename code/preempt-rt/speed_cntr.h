@@ -21,6 +21,8 @@
 #ifndef SPEED_CNTR_H
 #define SPEED_CNTR_H
 
+#include <stdint.h>
+
 
 /*! \brief Holding data used by timer interrupt for speed ramp calculation.
  *
@@ -34,17 +36,57 @@ typedef struct {
   //! Direction stepper motor should move.
   unsigned char dir;
   //! Peroid of next timer delay. At start this value set the accelration rate.
-  unsigned int step_delay;
+  uint32_t step_delay;
   //! What step_pos to start decelaration
-  unsigned int decel_start;
+  uint32_t decel_start;
   //! Sets deceleration rate.
-  signed int decel_val;
+  int32_t decel_val;
   //! Minimum time delay (max speed)
-  signed int min_delay;
+  uint32_t min_delay;
   //! Counter used when accelerateing/decelerateing to calculate step_delay.
-  signed int accel_count;
+  int32_t accel_count;
+  //! accel_count where deceleration ends, 0 to stop, below 0 at exit speed.
+  //! Last step of an S-curve move.
+  int32_t decel_end;
+  //! TRUE for S-curve move, decel from RUN goes to SDECEL.
+  unsigned char scurve;
+  //! TRUE in velocity mode, runs until speed is set to 0.
+  unsigned char velocity;
+  //! TRUE when DECEL goes to RUN at accel_count decel_val (new lower speed).
+  unsigned char slowdown;
+  //! Accel/decel and exit speed of the move, for speed_cntr_Speed().
+  unsigned int accel;
+  unsigned int decel;
+  unsigned int exit;
 } speedRampData;
 
+//! Size of each precomputed delay table (accel and decel).
+#define RAMP_TABLE_SIZE 4096
+
+/*! \brief Precomputed step delays for the current move.
+ *
+ *  When enabled, speed_cntr_Move() runs the accel and decel recurrence
+ *  off-line and stores every step_delay here, so the timer interrupt only
+ *  has to index the table instead of dividing on every step.
+ */
+typedef struct {
+  //! Compile ramp tables in speed_cntr_Move().
+  unsigned char enabled;
+  //! True when the tables hold the current move.
+  unsigned char valid;
+  //! Number of delays in accel table.
+  unsigned int accel_len;
+  //! Number of delays in decel table.
+  unsigned int decel_len;
+  //! Step delay after each accel step, indexed by accel_count-1.
+  //! S-curve move: by step_count-1.
+  //! RAMP_TABLE_SIZE entries, swapped with the next move's table.
+  uint32_t *accel;
+  //! Step delay after each decel step, indexed by accel_count-decel_val-1.
+  //! S-curve move: by step_count-decel_start, from the last RUN step.
+  uint32_t *decel;
+} speedRampTable;
+
 /*! \Brief Frequency of timer1 in [Hz].
  *
  * Modify this according to frequency used. Because of the prescaler setting,
@@ -53,8 +95,12 @@ typedef struct {
 // Timer/Counter 1 running on 3,686MHz / 8 = 460,75kHz (2,17uS). (T1-FREQ 460750)
 //#define T1_FREQ 460750
 
+// Delays are 32 bit and the maths below uses 64 bit intermediates, so the
+// timer frequency can be raised into the MHz range, eg. make T1_FREQ=460750
+#ifndef T1_FREQ
 /* 4.6kHz */
 #define T1_FREQ 4607
+#endif
 
 //! Number of (full)steps per round on stepper motor in use.
 #define FSPR 400 
@@ -62,10 +108,12 @@ typedef struct {
 
 #ifdef HALFSTEPS
   #define SPR (FSPR*2)
+  #define SPR_HALFSTEPS 1
   #pragma message("[speed_cntr.c] *** Using Halfsteps ***")
 #endif
 #ifdef FULLSTEPS
   #define SPR FSPR
+  #define SPR_HALFSTEPS 0
   #pragma message("[speed_cntr.c] *** Using Fullsteps ***")
 #endif
 #ifndef HALFSTEPS
@@ -74,22 +122,152 @@ typedef struct {
   #endif
 #endif
 
+//! RT loop period in [ns], rounded to a whole number of timer ticks.
+#define LOOP_PERIOD_NS 217000
+
 // Maths constants. To simplify maths when calculating in speed_cntr_Move().
-#define ALPHA (2*3.14159/SPR)                    // 2*pi/spr
-#define A_T_x100 ((long)(ALPHA*T1_FREQ*100))     // (ALPHA / T1_FREQ)*100
-#define T1_FREQ_148 ((int)((T1_FREQ*0.676)/100)) // divided by 100 and scaled by 0.676
-#define A_SQ (long)(ALPHA*2*10000000000)         // ALPHA*2*10000000000
-#define A_x20000 (int)(ALPHA*20000)              // ALPHA*20000
+// The _OF() forms take timer frequency and steps per round as parameters,
+// the plain forms are the compiled-in default.
+#define ALPHA_OF(spr) (2*3.14159/(spr))                                  // 2*pi/spr
+#define A_T_x100_OF(f, spr) ((int64_t)(ALPHA_OF(spr)*(f)*100))            // (ALPHA / T1_FREQ)*100
+#define T1_FREQ_676_OF(f) ((int64_t)(f)*676)                             // scaled by 0.676*1000, not truncated
+#define A_SQ_OF(spr) (int64_t)(ALPHA_OF(spr)*2*10000000000)              // ALPHA*2*10000000000
+#define A_x20000_OF(spr) (int)(ALPHA_OF(spr)*20000)                      // ALPHA*20000
+#define PERIOD_TICKS_OF(f) ((((int64_t)(f)*LOOP_PERIOD_NS + 500000000)/1000000000) ? \
+                            (((int64_t)(f)*LOOP_PERIOD_NS + 500000000)/1000000000) : 1)
+
+#define ALPHA ALPHA_OF(SPR)
+#define A_T_x100 A_T_x100_OF(T1_FREQ, SPR)
+#define T1_FREQ_676 T1_FREQ_676_OF(T1_FREQ)
+#define A_SQ A_SQ_OF(SPR)
+#define A_x20000 A_x20000_OF(SPR)
+
+/*! \brief Controller parameters, set at runtime by speed_cntr_Config().
+ *
+ *  Timer frequency, motor and step mode, and the maths constants derived
+ *  from them, validated together. Defaults to the compiled-in
+ *  T1_FREQ/FSPR/HALFSTEPS.
+ */
+typedef struct {
+  //! Frequency of timer1 in [Hz].
+  uint32_t t1_freq;
+  //! Number of (full)steps per round on stepper motor in use.
+  uint32_t fspr;
+  //! TRUE when using halfsteps.
+  uint8_t halfsteps;
+  //! Number of steps per round.
+  uint32_t spr;
+  //! Maths constants, see A_T_x100, T1_FREQ_676, A_SQ and A_x20000.
+  int64_t a_t_x100;
+  int64_t t1_freq_676;
+  int64_t a_sq;
+  int32_t a_x20000;
+  //! Timer ticks per RT loop period.
+  uint32_t period_ticks;
+  //! RT loop period in [ns], a whole number of timer ticks.
+  uint32_t period_ns;
+} speedCntrParams;
+
+//! Parameters for a configuration, constant folded for constant arguments.
+#define SPEED_CNTR_PARAMS(f, fspr, half) { \
+  (f), (fspr), (half), (fspr)*((half) ? 2 : 1), \
+  A_T_x100_OF(f, (fspr)*((half) ? 2 : 1)), \
+  T1_FREQ_676_OF(f), \
+  A_SQ_OF((fspr)*((half) ? 2 : 1)), \
+  A_x20000_OF((fspr)*((half) ? 2 : 1)), \
+  PERIOD_TICKS_OF(f), \
+  (uint32_t)(PERIOD_TICKS_OF(f)*1000000000/(f)) }
+
+// Integer square root used by my_sqrt(), chosen per target at build time,
+// eg. make MY_SQRT=2. All give the same result for 32 bit input.
+#define MY_SQRT_LOOP   0  // bit by bit, no division, for targets without divide
+#define MY_SQRT_NEWTON 1  // count leading zeros seed and Newton
+#define MY_SQRT_TABLE  2  // 256 entry table seed and Newton
+#ifndef MY_SQRT
+  #if defined(__GNUC__)
+    #define MY_SQRT MY_SQRT_TABLE
+  #else
+    #define MY_SQRT MY_SQRT_LOOP
+  #endif
+#endif
 
 // Speed ramp states
 #define STOP  0
 #define ACCEL 1
 #define DECEL 2
 #define RUN   3
+// Jerk limited (S-curve) ramp states, delays from srt
+#define SACCEL 4
+#define SDECEL 5
+
+/*! \brief One speed ramp controller.
+ *
+ *  Everything the timer interrupt and the move planning work on, so several
+ *  controllers can run at once, eg. one per axis on its own RT thread.
+ *  Hot fields used on every step come first, aligned to a cache line so
+ *  controllers in an array do not share lines between threads.
+ */
+typedef struct {
+  //! Speed ramp of the running move.
+  speedRampData ramp;
+  //! Counting steps when moving, reset on a new move.
+  uint32_t step_count;
+  //! Keep track of remainder from new_step-delay calculation to incrase accurancy
+  uint32_t rest;
+  //! Remember the last step delay used when accelrating.
+  uint32_t last_accel_delay;
+  //! Output Compare Register.
+  unsigned int ocr1a;
+  //! Timer Counter Control Register.
+  unsigned int tccr1b;
+  //! True when stepper motor is running.
+  unsigned char running;
+  //! Delay tables of the running move.
+  speedRampTable table;
+  //! Move planned by speed_cntr_Plan_Blend()/_SCurve(), swapped in by Start.
+  speedRampData next_ramp;
+  speedRampTable next_table;
+  //! TRUE when next_ramp holds a planned move.
+  unsigned char next_ready;
+  //! TRUE when the planned move continues at entry speed.
+  unsigned char next_blend;
+  //! Output Compare A Match Interrupt enable.
+  unsigned int timsk1;
+  //! Delay tables, one pair for the running move and one for the next.
+  uint32_t ramp_accel[2][RAMP_TABLE_SIZE];
+  uint32_t ramp_decel[2][RAMP_TABLE_SIZE];
+} __attribute__((aligned(64))) speedCntr;
+
+void speed_cntr_Init_Of(speedCntr *c);
+void speed_cntr_Move_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed);
+void speed_cntr_Move_Blend_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int entry, unsigned int exit);
+void speed_cntr_Move_SCurve_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk);
+unsigned char speed_cntr_Plan_Blend_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int entry, unsigned int exit);
+unsigned char speed_cntr_Plan_SCurve_Of(speedCntr *c, signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk);
+unsigned char speed_cntr_Ready_Of(speedCntr *c);
+void speed_cntr_Start_Of(speedCntr *c);
+void speed_cntr_Stop_Of(speedCntr *c);
+unsigned char speed_cntr_Speed_Of(speedCntr *c, unsigned int speed);
+unsigned char speed_cntr_Velocity_Of(speedCntr *c, unsigned char dir, unsigned int accel, unsigned int decel, unsigned int speed);
+void speed_cntr_Init_Timer1_Of(speedCntr *c);
+int speed_cntr_Step(speedCntr *c);
 
 void speed_cntr_Move(signed int step, unsigned int accel, unsigned int decel, unsigned int speed);
+void speed_cntr_Move_Blend(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int entry, unsigned int exit);
+void speed_cntr_Move_SCurve(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk);
+unsigned char speed_cntr_Plan_Blend(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int entry, unsigned int exit);
+unsigned char speed_cntr_Plan_SCurve(signed int step, unsigned int accel, unsigned int decel, unsigned int speed, unsigned int jerk);
+unsigned char speed_cntr_Ready(void);
+void speed_cntr_Start(void);
+void speed_cntr_Stop(void);
+unsigned char speed_cntr_Speed(unsigned int speed);
+unsigned char speed_cntr_Velocity(unsigned char dir, unsigned int accel, unsigned int decel, unsigned int speed);
 void speed_cntr_Init_Timer1(void);
-static unsigned long my_sqrt(unsigned long v);
+unsigned char speed_cntr_Config(uint32_t t1_freq, uint32_t fspr, uint8_t halfsteps);
+unsigned long my_sqrt(unsigned long v);
+unsigned long my_sqrt_loop(unsigned long x);
+unsigned long my_sqrt_newton(unsigned long x);
+unsigned long my_sqrt_table(unsigned long x);
 unsigned int min(unsigned int x, unsigned int y);
 
 // realtime thread
@@ -97,9 +275,15 @@ int speed_cntr_TIMER1_COMPA_interrupt( void );
 
 //! Global status flags
 extern struct GLOBAL_FLAGS status;
-extern unsigned int OCR1A;	/* Output Compare Register */
-extern unsigned int TCCR1B;	/* Timer Counter Control Register */
-extern speedRampData srd;
+extern speedCntrParams scp;
+
+// Default controller, used by the plain speed_cntr_ functions.
+extern speedCntr sc;
+#define srd (sc.ramp)
+#define srt (sc.table)
+#define OCR1A (sc.ocr1a)	/* Output Compare Register */
+#define TCCR1B (sc.tccr1b)	/* Timer Counter Control Register */
+#define TIMSK1 (sc.timsk1)	/* Output Compare A Match Interrupt enable */
 
 // Timer Counter Control Register bits */
 #define CS10 (0)
@@ -107,7 +291,6 @@ extern speedRampData srd;
 #define CS12 (2)
 #define WGM12 (3)
 
-extern unsigned int TIMSK1;	/* Output Compare A Match Interrupt enable */
 #define OCIE1A	(0)
 
 #endif
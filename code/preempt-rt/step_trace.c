@@ -0,0 +1,100 @@
+/*
+ * Step trace recorder
+ * the RT thread appends every step to a lock-free ring, a normal
+ * priority thread drains it to a binary file of struct step_trace_record
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "step_trace.h"
+
+/* records written per fwrite() */
+#define DRAIN_BATCH	1024
+
+/* drain period in ns, a quarter of the ring at 64k steps/s */
+#define DRAIN_PERIOD_NS	100000000
+
+struct step_trace step_trace;
+
+static FILE *trace_file;
+static pthread_t drain_thread;
+static atomic_int drain_stop;
+static unsigned long drain_count;
+
+/* write everything in the ring, return number of records */
+static int drain_ring(void)
+{
+	static struct step_trace_record batch[DRAIN_BATCH];
+	int i, n = 0, total = 0;
+
+	while ((i = rt_ring_peek(&step_trace.ring)) >= 0){
+		batch[n++] = step_trace.entry[i];
+		rt_ring_release(&step_trace.ring);
+		if (n == DRAIN_BATCH){
+			fwrite(batch, sizeof(batch[0]), n, trace_file);
+			total += n;
+			n = 0;
+		}
+	}
+	if (n)
+		fwrite(batch, sizeof(batch[0]), n, trace_file);
+	return total + n;
+}
+
+static void *drain_task(void *data)
+{
+	struct timespec period = { 0, DRAIN_PERIOD_NS };
+
+	(void)data;
+
+	while (!atomic_load(&drain_stop)){
+		drain_count += drain_ring();
+		nanosleep(&period, NULL);
+	}
+	/* the RT thread has stopped, take the rest */
+	drain_count += drain_ring();
+	return NULL;
+}
+
+/*
+ * open trace file and start the drain thread, with the default
+ * (non RT) scheduling of the calling thread
+ * return 0 on error
+ */
+int step_trace_open(const char *name)
+{
+	trace_file = fopen(name, "wb");
+	if (trace_file == NULL){
+		printf("ERROR: Could not open %s: %m\n", name);
+		return 0;
+	}
+	/* no page faults in the RT loop */
+	memset(step_trace.entry, 0, sizeof(step_trace.entry));
+	rt_ring_init(&step_trace.ring, STEP_TRACE_SIZE);
+	drain_count = 0;
+	atomic_store(&drain_stop, 0);
+	if (pthread_create(&drain_thread, NULL, drain_task, NULL)){
+		printf("ERROR: Could not start trace thread\n");
+		fclose(trace_file);
+		return 0;
+	}
+	step_trace.enabled = 1;
+	return 1;
+}
+
+/* must be called after the RT thread has stopped */
+void step_trace_close(void)
+{
+	if (!step_trace.enabled)
+		return;
+	atomic_store(&drain_stop, 1);
+	pthread_join(drain_thread, NULL);
+	fclose(trace_file);
+	step_trace.enabled = 0;
+	printf("traced %lu steps", drain_count);
+	if (step_trace.ring.dropped)
+		printf(", %lu dropped", step_trace.ring.dropped);
+	printf("\n");
+}
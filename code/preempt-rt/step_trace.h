@@ -0,0 +1,53 @@
+#ifndef STEP_TRACE_H
+#define STEP_TRACE_H
+
+#include <stdint.h>
+#include "rt_channel.h"
+
+/* records in the ring, power of 2, about 1s of steps at 64k steps/s */
+#define STEP_TRACE_SIZE		(1 << 16)
+
+/* binary trace file record, one per step */
+struct step_trace_record {
+	int64_t t_ns;		/* CLOCK_MONOTONIC of the step edge */
+	uint32_t step_delay;	/* timer ticks to the next step */
+	uint8_t dir;		/* CW or CCW */
+	uint8_t run_state;	/* run state after the step */
+	uint8_t port;		/* port value of the step */
+	uint8_t axis;		/* master axis */
+};
+
+struct step_trace {
+	struct rt_ring ring;
+	struct step_trace_record entry[STEP_TRACE_SIZE];
+	int enabled;
+};
+
+extern struct step_trace step_trace;
+
+int step_trace_open(const char *name);
+void step_trace_close(void);
+
+/* RT thread: append one step in constant time, dropped when full */
+static inline void step_trace_record(int64_t t_ns, uint32_t step_delay,
+		uint8_t dir, uint8_t run_state, uint8_t port, uint8_t axis)
+{
+	struct step_trace_record *r;
+	int i;
+
+	if (!step_trace.enabled)
+		return;
+	i = rt_ring_reserve(&step_trace.ring);
+	if (i < 0)
+		return;
+	r = &step_trace.entry[i];
+	r->t_ns = t_ns;
+	r->step_delay = step_delay;
+	r->dir = dir;
+	r->run_state = run_state;
+	r->port = port;
+	r->axis = axis;
+	rt_ring_commit(&step_trace.ring);
+}
+
+#endif